@@ -1 +1,25 @@
 #include "action_args.h"
+#include "database_mr.h"
+
+void ActionArgs::apply_overrides(DatabaseMetadata &metadata) const {
+	if (ann_eps)
+		metadata.ann_eps = *ann_eps;
+
+	if (ann_search_strategy)
+		metadata.ann_search_strategy = *ann_search_strategy;
+
+	if (ann_max_points_visited)
+		metadata.ann_max_points_visited = *ann_max_points_visited;
+
+	if (hnsw_ef_search)
+		metadata.hnsw_ef_search = *hnsw_ef_search;
+
+	if (candidate_pool_multiplier)
+		metadata.candidate_pool_multiplier = *candidate_pool_multiplier;
+
+	if (scan_thread_count)
+		metadata.scan_thread_count = *scan_thread_count;
+
+	if (ivf_probe_count)
+		metadata.ivf_probe_count = *ivf_probe_count;
+}
@@ -2,15 +2,38 @@
 #define BACKEND_ACTION_ARGS_H
 
 
+#include <boost/optional.hpp>
 #include <string>
+#include <vector>
+#include "util.h"
+
+struct DatabaseMetadata;
 
 class ActionArgs {
 public:
 	std::string input_file;
-	std::string database;
+	std::string database; // The first of databases
+	std::vector<std::string> databases; // All shards, with manifests expanded
 	bool append;
 	bool overwrite;
 	bool debug;
+
+	// Overrides of the database's ANN, HNSW, reranking, scan and IVF search settings, for this run only
+	boost::optional<double> ann_eps;
+	boost::optional<Util::AnnSearchStrategy> ann_search_strategy;
+	boost::optional<int> ann_max_points_visited;
+	boost::optional<int> hnsw_ef_search;
+	boost::optional<int> candidate_pool_multiplier;
+	boost::optional<int> scan_thread_count;
+	boost::optional<int> ivf_probe_count;
+
+	// Page of the matches of a RANGE query to print, counting from 0; all of them if not set
+	boost::optional<int> page;
+
+	// Random samples per histogram for query meshes that are not in the database; ITEMS_IN_HISTOGRAM_COUNT if not set
+	boost::optional<int> query_sample_count;
+
+	void apply_overrides(DatabaseMetadata &metadata) const;
 };
 
 
@@ -0,0 +1,102 @@
+#include "benchmark.h"
+#include "../benchmarks.h"
+
+static const int EMD_BENCHMARK_PAIR_COUNT = 200000;
+static const int INDEX_BENCHMARK_QUERY_COUNT = 1000;
+static const int SCAN_BENCHMARK_QUERY_COUNT = 100; // Fewer, as every STD query scans the whole store
+
+static void print_results(const std::string &benchmark, const std::vector<BenchmarkResult> &results) {
+	std::cout << "---------- " << benchmark << " ----------" << std::endl;
+
+	for (const BenchmarkResult &result : results) {
+		std::cout << result.name << ": " << result.seconds * 1e9 / result.iterations << " ns per iteration";
+
+		if (&result != &results.front()) {
+			std::cout << ", " << results.front().seconds / result.seconds << "x speedup"
+			          << ", max difference " << result.max_difference;
+		}
+
+		std::cout << std::endl;
+	}
+
+	std::cout << std::endl;
+}
+
+static void print_results(const std::string &benchmark, const std::vector<IndexBenchmarkResult> &results) {
+	std::cout << "---------- " << benchmark << " ----------" << std::endl;
+
+	for (const IndexBenchmarkResult &result : results) {
+		std::cout << result.name << ": build " << result.build_seconds * 1e3 << " ms"
+		          << ", " << result.file_size / 1024 << " KiB"
+		          << ", " << result.leaf_count << " leaves, " << result.split_count << " splits, "
+		          << result.shrink_count << " shrinks, depth " << result.depth
+		          << ", query " << result.query_seconds * 1e6 / result.query_count << " us";
+
+		if (&result != &results.front())
+			std::cout << ", max difference " << result.max_difference;
+
+		std::cout << std::endl;
+	}
+
+	std::cout << std::endl;
+}
+
+static void print_results(const std::string &benchmark, const std::vector<SearchBenchmarkResult> &results) {
+	std::cout << "---------- " << benchmark << " ----------" << std::endl;
+
+	for (const SearchBenchmarkResult &result : results) {
+		// Entries searching the same index follow each other, so its build is printed once, above the first
+		const bool is_new_index = &result == &results.front() || (&result)[-1].build_seconds != result.build_seconds;
+
+		if (result.build_seconds > 0 && is_new_index)
+			std::cout << "build " << result.build_seconds * 1e3 << " ms, " << result.file_size / 1024 << " KiB"
+			          << std::endl;
+
+		std::cout << result.name << ": query " << result.query_seconds * 1e6 / result.query_count << " us"
+		          << ", recall " << result.recall * 100.0 << "%" << std::endl;
+	}
+
+	std::cout << std::endl;
+}
+
+int Benchmark::run(const ActionArgs &action_args) {
+	print_results("EMD (" + std::to_string(EMD_BENCHMARK_PAIR_COUNT) + " histogram pairs)",
+	              Benchmarks::emd(EMD_BENCHMARK_PAIR_COUNT));
+
+	// The index benchmarks need real features, so they only run when a database is given
+	if (action_args.database.empty())
+		return 0;
+
+	if (!boost::filesystem::is_regular_file(action_args.database)) {
+		std::cout << "Database " << action_args.database << " does not exist." << std::endl;
+		return 8;
+	}
+
+	Database database;
+	database.open(action_args.database);
+
+	const DatabaseMetadata metadata = database.metadata();
+	const FeatureStore store = FeatureStore::load(database, action_args.debug);
+
+	print_results("ANN index (" + std::to_string(store.size()) + " shapes, "
+	              + std::to_string(std::min(INDEX_BENCHMARK_QUERY_COUNT, store.size())) + " KNN queries)",
+	              Benchmarks::ann_index(store, metadata, INDEX_BENCHMARK_QUERY_COUNT));
+
+	print_results("HNSW index (" + std::to_string(store.size()) + " shapes, m " + std::to_string(metadata.hnsw_m)
+	              + ", ef_construction " + std::to_string(metadata.hnsw_ef_construction) + ")",
+	              Benchmarks::hnsw_index(store, metadata, INDEX_BENCHMARK_QUERY_COUNT));
+
+	print_results("Reranked search (" + std::to_string(store.size()) + " shapes, "
+	              + std::to_string(std::min(SCAN_BENCHMARK_QUERY_COUNT, store.size())) + " queries)",
+	              Benchmarks::reranked_search(store, metadata, SCAN_BENCHMARK_QUERY_COUNT));
+
+	print_results("IVF index (" + std::to_string(store.size()) + " shapes, "
+	              + std::to_string(std::min(SCAN_BENCHMARK_QUERY_COUNT, store.size())) + " queries)",
+	              Benchmarks::ivf_index(store, metadata, SCAN_BENCHMARK_QUERY_COUNT));
+
+	print_results("STD scan threads (" + std::to_string(store.size()) + " shapes, "
+	              + std::to_string(std::min(SCAN_BENCHMARK_QUERY_COUNT, store.size())) + " queries)",
+	              Benchmarks::scan_threads(store, metadata, SCAN_BENCHMARK_QUERY_COUNT));
+
+	return 0;
+}
@@ -0,0 +1,14 @@
+#ifndef BACKEND_BENCHMARK_H
+#define BACKEND_BENCHMARK_H
+
+
+#include <iostream>
+#include "../action_args.h"
+#include "../action.h"
+
+class Benchmark : public Action {
+public:
+	static int run(const ActionArgs &action_args);
+};
+
+#endif //BACKEND_BENCHMARK_H
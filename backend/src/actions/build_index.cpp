@@ -0,0 +1,83 @@
+#include "build_index.h"
+#include "../ann_index.h"
+#include "../hnsw_index.h"
+#include "../ivf_index.h"
+#include "../pq_index.h"
+#include "../shards.h"
+
+int BuildIndex::run(const ActionArgs &action_args, Database &database) {
+	// Built as --query over the same shards searches them: normalized with the statistics of all shards, and with the
+	// matching settings of the first
+	const DatabaseStatistics statistics = Shards::merged_statistics(action_args.databases);
+	const DatabaseMetadata metadata = database.metadata();
+
+	for (const std::string &database_path : action_args.databases) {
+		Database shard;
+		shard.open(database_path);
+
+		const int exit_code = build(shard, statistics, metadata, action_args.debug);
+		if (exit_code != 0)
+			return exit_code;
+	}
+
+	return 0;
+}
+
+int BuildIndex::build(const Database &database, const DatabaseStatistics &statistics,
+                      const DatabaseMetadata &metadata, bool print) {
+	const FeatureStore store = FeatureStore::load(database, statistics, print);
+
+	if (metadata.feature_matching_method == Util::FeatureMatchingMethod::HNSW) {
+		const boost::filesystem::path index_path = HnswIndex::index_path(database.path());
+
+		if (print)
+			std::cout << "Building HNSW index over " << store.size() << " shapes" << std::endl;
+
+		if (!HnswIndex::build(store, metadata)->save(index_path)) {
+			std::cout << "Could not write HNSW index " << index_path.string() << std::endl;
+			return 2;
+		}
+
+		return 0;
+	}
+
+	if (metadata.feature_matching_method == Util::FeatureMatchingMethod::PQ) {
+		const boost::filesystem::path index_path = PqIndex::index_path(database.path());
+
+		if (print)
+			std::cout << "Building PQ index over " << store.size() << " shapes" << std::endl;
+
+		if (!PqIndex::build(store)->save(index_path)) {
+			std::cout << "Could not write PQ index " << index_path.string() << std::endl;
+			return 2;
+		}
+
+		return 0;
+	}
+
+	if (metadata.feature_matching_method == Util::FeatureMatchingMethod::IVF) {
+		const boost::filesystem::path index_path = IvfIndex::index_path(database.path());
+
+		if (print)
+			std::cout << "Building IVF index over " << store.size() << " shapes" << std::endl;
+
+		if (!IvfIndex::build(store, metadata)->save(index_path)) {
+			std::cout << "Could not write IVF index " << index_path.string() << std::endl;
+			return 2;
+		}
+
+		return 0;
+	}
+
+	const boost::filesystem::path index_path = AnnIndex::index_path(database.path());
+
+	if (print)
+		std::cout << "Building ANN index over " << store.size() << " shapes" << std::endl;
+
+	if (!AnnIndex::build(store, metadata)->save(index_path)) {
+		std::cout << "Could not write ANN index " << index_path.string() << std::endl;
+		return 2;
+	}
+
+	return 0;
+}
@@ -0,0 +1,20 @@
+#ifndef BACKEND_BUILD_INDEX_H
+#define BACKEND_BUILD_INDEX_H
+
+
+#include <boost/filesystem.hpp>
+#include <iostream>
+#include "../action_args.h"
+#include "../action.h"
+#include "../database_mr.h"
+
+class BuildIndex : public Action {
+public:
+	static int run(const ActionArgs &action_args, Database &database);
+
+private:
+	static int build(const Database &database, const DatabaseStatistics &statistics, const DatabaseMetadata &metadata,
+	                 bool print);
+};
+
+#endif //BACKEND_BUILD_INDEX_H
@@ -1,9 +1,11 @@
 #include "evaluate.h"
 #include "../evaluation.h"
 
-int Evaluate::run(const ActionArgs &action_args) {
-	std::string database_path = action_args.database;
-	std::vector<QualityValues> qualities = Evaluation::get_quality_values(database_path);
+int Evaluate::run(const ActionArgs &action_args, Database &database) {
+	DatabaseMetadata metadata = database.metadata();
+	action_args.apply_overrides(metadata);
+
+	std::vector<QualityValues> qualities = Evaluation::get_quality_values(database, metadata);
 
 	for (const QualityValues &quality : qualities) {
 		std::cout << "---------- " << quality.class_name << " ----------" << std::endl;
@@ -23,5 +25,21 @@ int Evaluate::run(const ActionArgs &action_args) {
 		std::cout << std::endl;
 	}
 
+	std::cout << "---------- Recall against STD ----------" << std::endl;
+	std::cout << "KNN: " << Evaluation::get_recall(database, metadata, Util::FeatureMatchingMethod::KNN) * 100.0 << "%"
+	          << std::endl;
+	std::cout << "RNN: " << Evaluation::get_recall(database, metadata, Util::FeatureMatchingMethod::RNN) * 100.0 << "%"
+	          << std::endl;
+	std::cout << "HNSW: " << Evaluation::get_recall(database, metadata, Util::FeatureMatchingMethod::HNSW) * 100.0
+	          << "%" << std::endl;
+	std::cout << "SQ8: " << Evaluation::get_recall(database, metadata, Util::FeatureMatchingMethod::SQ8) * 100.0 << "%"
+	          << std::endl;
+	std::cout << "PQ: " << Evaluation::get_recall(database, metadata, Util::FeatureMatchingMethod::PQ) * 100.0 << "%"
+	          << std::endl;
+	std::cout << "GLOBAL: " << Evaluation::get_recall(database, metadata, Util::FeatureMatchingMethod::GLOBAL) * 100.0
+	          << "%" << std::endl;
+	std::cout << "IVF: " << Evaluation::get_recall(database, metadata, Util::FeatureMatchingMethod::IVF) * 100.0 << "%"
+	          << std::endl;
+
 	return 0;
 }
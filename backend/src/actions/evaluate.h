@@ -6,11 +6,12 @@
 #include <iostream>
 #include "../action_args.h"
 #include "../action.h"
+#include "../database_mr.h"
 #include "../config.h"
 
 class Evaluate : public Action {
 public:
-	static int run(const ActionArgs &action_args);
+	static int run(const ActionArgs &action_args, Database &database);
 };
 
 #endif //BACKEND_EVALUATE_H
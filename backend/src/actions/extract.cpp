@@ -1,9 +1,10 @@
 #include "../database_mr.h"
 #include "extract.h"
 #include "../preprocessing.h"
+#include "../shards.h"
 
-int Extract::run(const ActionArgs &action_args) {
-	boost::filesystem::path if_abs_path = boost::filesystem::absolute(Database::metadata().cache_dir);
+int Extract::run(const ActionArgs &action_args, Database &database) {
+	boost::filesystem::path if_abs_path = boost::filesystem::absolute(database.metadata().cache_dir);
 
 	if (!boost::filesystem::exists(if_abs_path)) {
 		std::cout << "Input file does not exist." << std::endl;
@@ -29,10 +30,11 @@ int Extract::run(const ActionArgs &action_args) {
 		shapes.push_back(shape);
 	}
 
-	Database::add_shapes(shapes);
+	database.add_shapes(shapes);
 
-	std::vector<DatabaseShape> database_shapes = Database::shapes();
-	Database::add_shapes(Preprocessing::normalize_features_for_shapes(database_shapes, action_args.debug));
+	// Rewrites the feature snapshots and the stored indexes now, since --query only reads them. The new shapes change
+	// the statistics every shard is normalized with, so all shards are refreshed.
+	Shards::refresh(action_args.databases, action_args.debug);
 
 	return 0;
 }
\ No newline at end of file
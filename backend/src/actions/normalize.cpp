@@ -2,15 +2,15 @@
 #include "normalize.h"
 #include "../preprocessing.h"
 
-int Normalize::run(const ActionArgs &action_args) {
-	boost::filesystem::path if_abs_path = boost::filesystem::absolute(Database::metadata().originals_dir);
+int Normalize::run(const ActionArgs &action_args, Database &database) {
+	boost::filesystem::path if_abs_path = boost::filesystem::absolute(database.metadata().originals_dir);
 
 	if (!boost::filesystem::exists(if_abs_path)) {
 		std::cout << "Input file/directory does not exist." << std::endl;
 		return 1;
 	}
 
-	boost::filesystem::path of_abs_path = boost::filesystem::absolute(Database::metadata().cache_dir);
+	boost::filesystem::path of_abs_path = boost::filesystem::absolute(database.metadata().cache_dir);
 
 	if (boost::filesystem::exists(of_abs_path) && !(action_args.append || action_args.overwrite)) {
 		std::cout << "Output file/directory exists, but may not be overwritten or changed." << std::endl;
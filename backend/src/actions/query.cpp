@@ -1,41 +1,278 @@
+#include <atomic>
+#include <boost/algorithm/string.hpp>
+#include <fstream>
 #include <random>
+#include <thread>
 #include "query.h"
-#include "../database_mr.h"
 #include "../feature_matching.h"
+#include "../preprocessing.h"
+#include "../query_cache.h"
+#include "../shards.h"
+
+static const std::string QUERY_LIST_STDIN = "-";
+static const std::string QUERY_MESH_EXTENSION = ".off";
 
 int Query::run(const ActionArgs &action_args) {
-	boost::filesystem::path if_abs_path = boost::filesystem::absolute(action_args.input_file);
+	const bool batch = is_query_list(action_args.input_file);
+	std::vector<std::string> input_files;
+
+	if (batch) {
+		if (action_args.input_file != QUERY_LIST_STDIN
+		    && !boost::filesystem::is_regular_file(action_args.input_file)) {
+			std::cout << "Query list does not exist." << std::endl;
+			return 1;
+		}
+
+		input_files = read_query_list(action_args.input_file);
+	} else {
+		input_files.push_back(action_args.input_file);
+	}
+
+	// Kept for query meshes that are not in the database, which are normalized as the stores are
+	const DatabaseStatistics statistics = Shards::merged_statistics(action_args.databases);
+
+	// Matching settings are taken from the first shard; result paths from the shard each result came from
+	std::vector<DatabaseMetadata> shard_metadata = Shards::metadata(action_args.databases);
+	action_args.apply_overrides(shard_metadata[0]);
+	DatabaseMetadata &metadata = shard_metadata[0];
+
+	const int sample_count = std::max(action_args.query_sample_count.value_or(ITEMS_IN_HISTOGRAM_COUNT), 1);
+
+	// Looked up before any feature store is loaded, so queries the cache answers load none
+	const boost::filesystem::path cache_path = QueryCache::cache_path(action_args.databases[0]);
+	const uint64_t cache_fingerprint = QueryCache::fingerprint(action_args.databases, shard_metadata, statistics,
+	                                                           metadata);
+	std::shared_ptr<QueryCache> cache = QueryCache::load(cache_path, cache_fingerprint, metadata.query_cache_capacity);
+
+	std::vector<std::vector<CachedMatch>> matches(input_files.size());
+	std::vector<std::vector<std::string>> result_paths(input_files.size());
+	std::vector<std::string> errors(input_files.size());
+	std::vector<int> exit_codes(input_files.size());
+	std::vector<uint64_t> cache_keys(input_files.size());
+	std::vector<char> keyed(input_files.size(), false);
+	std::vector<size_t> uncached_inputs;
+
+	for (size_t i = 0; i < input_files.size(); i++) {
+		exit_codes[i] = check_input(input_files[i], errors[i]);
+
+		if (exit_codes[i] != 0)
+			continue;
+
+		keyed[i] = QueryCache::key(input_files[i], sample_count, cache_keys[i]);
+
+		if (!keyed[i] || !cache->find(cache_keys[i], matches[i]))
+			uncached_inputs.push_back(i);
+	}
+
+	if (!uncached_inputs.empty()) {
+		std::vector<DatabaseMetadata> loaded_metadata;
+		std::vector<FeatureStore> stores = Shards::load(action_args.databases, statistics, loaded_metadata,
+		                                                action_args.debug);
+
+		for (FeatureStore &store : stores)
+			store.build_index_if_needed(metadata, metadata.feature_matching_method);
+
+		std::atomic<size_t> next_input(0);
+		const size_t thread_count = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(),
+		                                                                 uncached_inputs.size()));
+		std::vector<std::thread> threads;
+
+		// A batch already keeps every core busy with queries of its own
+		if (thread_count > 1)
+			metadata.scan_thread_count = 1;
+
+		for (size_t thread = 0; thread < thread_count; thread++) {
+			threads.emplace_back([&]() {
+				for (size_t j = next_input++; j < uncached_inputs.size(); j = next_input++) {
+					const size_t i = uncached_inputs[j];
+					exit_codes[i] = match(input_files[i], stores, metadata, statistics, sample_count, matches[i],
+					                      errors[i]);
+
+					if (exit_codes[i] == 0 && keyed[i])
+						cache->insert(cache_keys[i], matches[i]);
+				}
+			});
+		}
+
+		for (std::thread &thread : threads)
+			thread.join();
+	}
+
+	for (size_t i = 0; i < input_files.size(); i++) {
+		if (exit_codes[i] == 0)
+			exit_codes[i] = answer(matches[i], shard_metadata, action_args.page, result_paths[i], errors[i]);
+	}
+
+	// Results are answered either way, so a cache that cannot be written only costs later queries time
+	if (!cache->save(cache_path) && action_args.debug)
+		std::cout << "Could not write query cache " << cache_path.string() << std::endl;
+
+	if (!batch) {
+		if (exit_codes[0] != 0) {
+			std::cout << errors[0] << std::endl;
+			return exit_codes[0];
+		}
+
+		std::cout << boost::algorithm::join(result_paths[0], "\n");
+		return 0;
+	}
+
+	int exit_code = 0;
+
+	for (size_t i = 0; i < input_files.size(); i++) {
+		std::cout << input_files[i];
+
+		for (const std::string &result_path : result_paths[i])
+			std::cout << "\t" << result_path;
+
+		std::cout << std::endl;
+
+		// A mesh without matches is an answer too; a mesh that could not be queried fails the batch
+		if (exit_codes[i] == 1) {
+			std::cerr << input_files[i] << ": " << errors[i] << std::endl;
+			exit_code = 1;
+		}
+	}
+
+	return exit_code;
+}
+
+bool Query::is_query_list(const std::string &input_file) {
+	return input_file == QUERY_LIST_STDIN
+	       || boost::algorithm::to_lower_copy(boost::filesystem::path(input_file).extension().string())
+	          != QUERY_MESH_EXTENSION;
+}
+
+std::vector<std::string> Query::read_query_list(const std::string &input_file) {
+	std::vector<std::string> input_files;
+	std::ifstream list_file;
+	boost::filesystem::path list_directory = boost::filesystem::current_path();
+
+	if (input_file != QUERY_LIST_STDIN) {
+		list_file.open(input_file);
+		list_directory = boost::filesystem::absolute(input_file).parent_path();
+	}
+
+	std::istream &list = input_file == QUERY_LIST_STDIN ? std::cin : list_file;
+	std::string line;
+
+	while (std::getline(list, line)) {
+		boost::algorithm::trim(line);
+
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		boost::filesystem::path input_path(line);
+		if (input_path.is_relative())
+			input_path = list_directory / input_path;
+
+		input_files.push_back(input_path.string());
+	}
+
+	return input_files;
+}
+
+int Query::check_input(const std::string &input_file, std::string &error) {
+	const boost::filesystem::path if_abs_path = boost::filesystem::absolute(input_file);
 
 	if (!boost::filesystem::exists(if_abs_path)) {
-		std::cout << "Input file does not exist." << std::endl;
+		error = "Input file does not exist.";
 		return 1;
 	}
 
 	if (!boost::filesystem::is_regular_file(if_abs_path)) {
-		std::cout << "Input has to be a file, not a directory." << std::endl;
+		error = "Input has to be a file, not a directory.";
 		return 1;
 	}
 
-	std::string query_result;
+	return 0;
+}
+
+int Query::match(const std::string &input_file, const std::vector<FeatureStore> &stores,
+                 const DatabaseMetadata &metadata, const DatabaseStatistics &statistics, int sample_count,
+                 std::vector<CachedMatch> &matches, std::string &error) {
+	const std::string input_filename = Util::filename_of_abs_path(input_file);
+	int input_shard = -1;
+	int input_shape_id = -1;
 
-	DatabaseShape input_shape = Database::get_shape_from_filename(Util::filename_of_abs_path(action_args.input_file));
-	std::vector<DatabaseShape> similar_shapes = FeatureMatching::get_similar_shapes(input_shape, Database::shapes(), Database::metadata().feature_matching_method);
+	for (int shard = 0; shard < stores.size() && input_shape_id < 0; shard++) {
+		input_shard = shard;
+		input_shape_id = stores[shard].shape_id(input_filename);
+	}
 
-	for (int i = 0; i < similar_shapes.size(); i++) {
-		query_result += boost::filesystem::absolute(Database::metadata().cache_dir + Util::separator() + similar_shapes[i].filename).string();
+	FeatureVector query{};
 
-		if (i != similar_shapes.size() - 1)
-			query_result += "\n";
+	if (input_shape_id >= 0) {
+		query = stores[input_shard].feature_vector(input_shape_id);
+	} else {
+		input_shard = -1;
+
+		if (!extract(boost::filesystem::absolute(input_file), statistics, sample_count, query)) {
+			error = "Input file could not be read.";
+			return 1;
+		}
+	}
+
+	std::vector<ShardMatch> similar_shapes;
+
+	if (stores.size() == 1) {
+		for (const ShapeMatch &match : FeatureMatching::get_similar_shapes(query, input_shape_id, stores[0], metadata,
+		                                                                   metadata.feature_matching_method))
+			similar_shapes.push_back({0, match.shape_id, match.distance});
+	} else {
+		similar_shapes = FeatureMatching::get_similar_shapes_federated(query, input_shard, input_shape_id, stores,
+		                                                               metadata, metadata.feature_matching_method);
 	}
 
+	for (const ShardMatch &match : similar_shapes)
+		matches.push_back({match.shard, stores[match.shard].filename(match.shape_id)});
+
+	return 0;
+}
+
+int Query::answer(const std::vector<CachedMatch> &matches, const std::vector<DatabaseMetadata> &shard_metadata,
+                  const boost::optional<int> &page, std::vector<std::string> &result_paths, std::string &error) {
+	const DatabaseMetadata &metadata = shard_metadata[0];
+	size_t page_begin = 0;
+	size_t page_end = matches.size();
+
+	// Pages are cut from all matches, so every page of a query is answered from the cache once one was
+	if (page && metadata.feature_matching_method == Util::FeatureMatchingMethod::RANGE) {
+		const size_t page_size = std::max(metadata.maximum_returned_matches, 0);
+		page_begin = std::min(matches.size(), (size_t) std::max(*page, 0) * page_size);
+		page_end = std::min(matches.size(), page_begin + page_size);
+	}
 
-	bool query_result_found = !similar_shapes.empty();
+	for (size_t i = page_begin; i < page_end; i++) {
+		result_paths.push_back(boost::filesystem::absolute(shard_metadata[matches[i].shard].cache_dir
+		                                                   + Util::separator() + matches[i].filename).string());
+	}
 
-	if (!query_result_found) {
-		std::cout << "No similar mesh found in database." << std::endl;
+	if (result_paths.empty()) {
+		error = "No similar mesh found in database.";
 		return 3;
 	}
 
-	std::cout << query_result;
 	return 0;
-}
\ No newline at end of file
+}
+
+bool Query::extract(const boost::filesystem::path &input_path, const DatabaseStatistics &statistics,
+                    int sample_count, FeatureVector &query) {
+	SurfaceMesh mesh;
+
+	try {
+		mesh.read(input_path.string());
+	} catch (const std::exception &) {
+		return false;
+	}
+
+	if (mesh.n_faces() == 0)
+		return false;
+
+	// As --store does, but nothing is written: the normalized mesh stays in memory and the features in query
+	Preprocessing::normalize_shape(mesh, false);
+	const DatabaseShape shape = Preprocessing::extract_shape(mesh, sample_count, false);
+
+	query = FeatureStore::feature_vector(Preprocessing::normalize_features_for_shape(shape, statistics, false));
+	return true;
+}
@@ -6,10 +6,44 @@
 #include <iostream>
 #include "../action_args.h"
 #include "../action.h"
+#include "../database_mr.h"
+#include "../feature_store.h"
+#include "../query_cache.h"
 
+// --query takes either one mesh, or a query list: a text file (or '-' for stdin) with one mesh path per line,
+// relative to the list. Empty lines and lines starting with '#' are ignored.
+// A list is answered against one loaded feature set, spread over all cores, with one output line per mesh in list
+// order: the mesh path followed by the paths of its matches, separated by tabs.
+// A mesh whose filename is not in the database is normalized and extracted in memory, and never stored.
+// Results are cached under the filename and contents of the query mesh, and a mesh found in the cache is answered
+// without loading the feature stores.
+// The databases are opened read-only, and the query cache is the only file written next to them.
 class Query : public Action {
 public:
 	static int run(const ActionArgs &action_args);
+
+private:
+	static bool is_query_list(const std::string &input_file);
+
+	static std::vector<std::string> read_query_list(const std::string &input_file);
+
+	// Returns 0, or returns the exit code of a single query and fills error if the input is not a file
+	static int check_input(const std::string &input_file, std::string &error);
+
+	// Returns 0 and fills matches, or returns the exit code of a single query and fills error.
+	// Meshes that are not in the database are extracted with sample_count samples per histogram.
+	static int match(const std::string &input_file, const std::vector<FeatureStore> &stores,
+	                 const DatabaseMetadata &metadata, const DatabaseStatistics &statistics, int sample_count,
+	                 std::vector<CachedMatch> &matches, std::string &error);
+
+	// Returns 0 and fills result_paths with the paths of the matches, or returns the exit code of a query without
+	// matches and fills error. page selects part of the matches of RANGE matching.
+	static int answer(const std::vector<CachedMatch> &matches, const std::vector<DatabaseMetadata> &shard_metadata,
+	                  const boost::optional<int> &page, std::vector<std::string> &result_paths, std::string &error);
+
+	// The normalized features of a mesh, z-scored with statistics. Returns false if the mesh cannot be read.
+	static bool extract(const boost::filesystem::path &input_path, const DatabaseStatistics &statistics,
+	                    int sample_count, FeatureVector &query);
 };
 
 
@@ -1,7 +1,8 @@
 #include "../preprocessing.h"
+#include "../shards.h"
 #include "store.h"
 
-int Store::run(const ActionArgs &action_args) {
+int Store::run(const ActionArgs &action_args, Database &database) {
 	boost::filesystem::path if_abs_path = boost::filesystem::absolute(action_args.input_file);
 
 	if (!boost::filesystem::exists(if_abs_path)) {
@@ -22,7 +23,7 @@ int Store::run(const ActionArgs &action_args) {
 
 	bool flip_faces = Preprocessing::normalize_shape(mesh, action_args.debug);
 
-	boost::filesystem::path of_abs_path = boost::filesystem::absolute(Database::metadata().cache_dir).string()
+	boost::filesystem::path of_abs_path = boost::filesystem::absolute(database.metadata().cache_dir).string()
 	                                      + Util::separator()
 	                                      + Util::filename_of_abs_path(if_abs_path);
 
@@ -33,10 +34,11 @@ int Store::run(const ActionArgs &action_args) {
 
 	DatabaseShape shape = Preprocessing::extract_shape(mesh, action_args.debug);
 	shape.filename = Util::filename_of_abs_path(of_abs_path);
-	Database::add_shape(shape);
+	database.add_shape(shape);
 
-	const std::vector<DatabaseShape> shapes = Database::shapes();
-	Database::add_shapes(Preprocessing::normalize_features_for_shapes(shapes, action_args.debug));
+	// Rewrites the feature snapshots and the stored indexes now, since --query only reads them. The new shapes change
+	// the statistics every shard is normalized with, so all shards are refreshed.
+	Shards::refresh(action_args.databases, action_args.debug);
 
 	return 0;
 }
\ No newline at end of file
@@ -7,10 +7,11 @@
 #include <iostream>
 #include "../action_args.h"
 #include "../action.h"
+#include "../database_mr.h"
 
 class Store : public Action {
 public:
-    static int run(const ActionArgs &action_args);
+    static int run(const ActionArgs &action_args, Database &database);
 };
 
 
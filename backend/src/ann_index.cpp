@@ -0,0 +1,258 @@
+#include "ann_index.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include "config.h"
+
+/*
+ * Index file layout: one header line
+ *     MRKDTREE <version> <dimension> <shape count> <generation> <statistics checksum> <scales checksum>
+ *              <tree> <split rule> <shrink rule> <dump checksum>
+ * followed by the ANN dump of the tree, points included.
+ * ANN aborts the process on a malformed dump, so the dump is checksummed before ANN gets to read it.
+ */
+
+static const std::string ANN_INDEX_MAGIC = "MRKDTREE";
+static const int ANN_INDEX_VERSION = 3;
+
+std::mutex AnnIndex::ann_mutex;
+
+AnnIndex::~AnnIndex() {
+	std::lock_guard<std::mutex> ann_lock(ann_mutex);
+
+	delete tree;
+	delete[] points;
+}
+
+std::shared_ptr<const AnnIndex> AnnIndex::build(const FeatureStore &store, const DatabaseMetadata &metadata) {
+	std::lock_guard<std::mutex> ann_lock(ann_mutex);
+
+	std::shared_ptr<AnnIndex> index(new AnnIndex());
+	index->shape_count = store.size();
+	index->generation = store.generation();
+	index->statistics_checksum = store.statistics_checksum();
+	index->scales = FeatureMatching::dimension_scales(metadata);
+	index->tree_type = metadata.ann_tree;
+	index->split_rule = metadata.ann_split_rule;
+	index->shrink_rule = shrink_rule_for(metadata);
+
+	index->points = new ANNpoint[store.size()];
+	index->fill_points(store);
+
+	// Util::AnnSplitRule and Util::AnnShrinkRule are declared in the order of ANN's own rules
+	if (index->tree_type == Util::AnnTree::BD_TREE) {
+		index->tree = new ANNbd_tree( // build search structure
+				index->points, // the data points
+				store.size(), // number of points
+				FEATURE_VECTOR_DIMENSION, // dimension of space
+				1, // bucket size
+				(ANNsplitRule) index->split_rule, // splitting method
+				(ANNshrinkRule) index->shrink_rule); // shrinking method
+	} else {
+		index->tree = new ANNkd_tree( // build search structure
+				index->points, // the data points
+				store.size(), // number of points
+				FEATURE_VECTOR_DIMENSION, // dimension of space
+				1, // bucket size
+				(ANNsplitRule) index->split_rule); // splitting method
+	}
+
+	return index;
+}
+
+std::shared_ptr<const AnnIndex> AnnIndex::load(const boost::filesystem::path &path, const FeatureStore &store,
+                                                const DatabaseMetadata &metadata) {
+	std::ifstream file(path.string(), std::ios::binary);
+
+	if (!file)
+		return nullptr;
+
+	std::string header_line;
+	std::getline(file, header_line);
+
+	std::istringstream header(header_line);
+	std::string magic;
+	int version = 0;
+	int dimension = 0;
+	uint64_t scales_checksum = 0;
+	std::string tree_type;
+	std::string split_rule;
+	std::string shrink_rule;
+	uint64_t dump_checksum = 0;
+
+	std::shared_ptr<AnnIndex> index(new AnnIndex());
+	index->scales = FeatureMatching::dimension_scales(metadata);
+
+	header >> magic >> version >> dimension >> index->shape_count >> index->generation >> index->statistics_checksum
+	       >> scales_checksum >> tree_type >> split_rule >> shrink_rule >> dump_checksum;
+
+	// The scales are not stored, only checked: the exact coordinates are recomputed from the store below anyway
+	if (header.fail() || magic != ANN_INDEX_MAGIC || version != ANN_INDEX_VERSION
+	    || dimension != FEATURE_VECTOR_DIMENSION || scales_checksum != FeatureMatching::checksum(index->scales)
+	    || !Util::EnumFromString(tree_type, Util::BD_TREE, index->tree_type)
+	    || !Util::EnumFromString(split_rule, Util::KD_SUGGEST, index->split_rule)
+	    || !Util::EnumFromString(shrink_rule, Util::BD_SUGGEST, index->shrink_rule)
+	    || !index->matches(store, metadata))
+		return nullptr;
+
+	const std::string dump((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+	if (Util::hash(dump.data(), dump.size()) != dump_checksum)
+		return nullptr;
+
+	std::lock_guard<std::mutex> ann_lock(ann_mutex);
+
+	// Reading a dump can refer to ANN's shared empty leaf before anything has allocated it; building a tree does
+	delete new ANNkd_tree(0, FEATURE_VECTOR_DIMENSION);
+
+	std::istringstream dump_stream(dump);
+
+	if (index->tree_type == Util::AnnTree::BD_TREE)
+		index->tree = new ANNbd_tree(dump_stream);
+	else
+		index->tree = new ANNkd_tree(dump_stream);
+
+	// The dump holds the points to 15 digits only. The reader allocated them with annAllocPts(): one block of
+	// coordinates, which is replaced by the exact features, and the array of pointers into it, which is kept.
+	index->points = index->tree->thePoints();
+	if (index->shape_count > 0)
+		delete[] index->points[0];
+	index->fill_points(store);
+
+	return index;
+}
+
+boost::filesystem::path AnnIndex::index_path(const boost::filesystem::path &database_path) {
+	return database_path.string() + ".kdtree";
+}
+
+bool AnnIndex::save(const boost::filesystem::path &path) const {
+	std::ostringstream dump_stream;
+	tree->Dump(ANNtrue, dump_stream);
+
+	const std::string dump = dump_stream.str();
+
+	return Util::write_file_atomically(path, [&](std::ostream &file) {
+		file << ANN_INDEX_MAGIC << " " << ANN_INDEX_VERSION << " " << FEATURE_VECTOR_DIMENSION << " " << shape_count
+		     << " " << generation << " " << statistics_checksum << " " << FeatureMatching::checksum(scales) << " "
+		     << Util::ToString(tree_type) << " " << Util::ToString(split_rule) << " " << Util::ToString(shrink_rule)
+		     << " " << Util::hash(dump.data(), dump.size())
+		     << "\n" << dump;
+	});
+}
+
+bool AnnIndex::matches(const FeatureStore &store, const DatabaseMetadata &metadata) const {
+	return shape_count == store.size()
+	       && generation == store.generation()
+	       && statistics_checksum == store.statistics_checksum()
+	       && is_weighted_for(metadata)
+	       && tree_type == metadata.ann_tree
+	       && split_rule == metadata.ann_split_rule
+	       && shrink_rule == shrink_rule_for(metadata);
+}
+
+bool AnnIndex::is_weighted_for(const DatabaseMetadata &metadata) const {
+	return scales == FeatureMatching::dimension_scales(metadata);
+}
+
+std::vector<ShapeMatch>
+AnnIndex::search(const FeatureVector &query, int query_shape_id, const DatabaseMetadata &metadata,
+                 Util::FeatureMatchingMethod search_type) const {
+	std::vector<ShapeMatch> similar_shapes_indices;
+
+	// One neighbor more is asked for when the query is in the store, as ANN finds the query itself too.
+	// ANN aborts when asked for more neighbors than there are points.
+	const bool query_in_store = query_shape_id >= 0 && query_shape_id < shape_count;
+	const int match_count = std::min(metadata.maximum_returned_matches, shape_count - (int) query_in_store);
+	int k = match_count + (int) query_in_store; // number of nearest neighbors
+	double eps = metadata.ann_eps; // error bound
+
+	// Moved into the space of the points; this also makes the point non-const, which ANN takes
+	FeatureVector query_point;
+	FeatureMatching::scaled_features(query, scales, query_point.values);
+
+	ANNdist square_radius = // in the same weighted L1 distance
+			metadata.maximum_feature_matching_distance * metadata.maximum_feature_matching_distance;
+
+	annMaxPtsVisit(metadata.ann_max_points_visited); // thread_local, like the rest of ANN's search state
+
+	// A range search first counts the shapes within the radius (ANN takes k = 0 as a count-only search), and then
+	// asks for exactly that many
+	if (search_type == Util::FeatureMatchingMethod::RANGE)
+		k = tree->annkFRSearch(query_point.values, square_radius, 0, nullptr, nullptr, eps);
+
+	if (k <= 0)
+		return similar_shapes_indices;
+
+	std::vector<ANNidx> nnIdx(k); // near neighbor indices
+	std::vector<ANNdist> dists(k); // near neighbor distances
+
+	if (search_type == Util::FeatureMatchingMethod::KNN) {
+		if (metadata.ann_search_strategy == Util::AnnSearchStrategy::PRIORITY) {
+			tree->annkPriSearch( // search
+					query_point.values, // query point
+					k, // number of near neighbors
+					nnIdx.data(), // nearest neighbors (returned)
+					dists.data(), // distance (returned)
+					eps); // error bound
+		} else {
+			tree->annkSearch( // search
+					query_point.values, // query point
+					k, // number of near neighbors
+					nnIdx.data(), // nearest neighbors (returned)
+					dists.data(), // distance (returned)
+					eps); // error bound
+		}
+
+		// ANN returns the weighted L1 distance, of which STD takes the square root.
+		// A search that runs out of ann_max_points_visited leaves the remaining neighbors unset.
+		for (int i = 0; i < k; i++) {
+			dists[i] = sqrt(dists[i]);
+
+			if (nnIdx[i] >= 0 && nnIdx[i] != query_shape_id)
+				similar_shapes_indices.push_back({nnIdx[i], dists[i]});
+		}
+	} else if (search_type == Util::FeatureMatchingMethod::RNN
+	           || search_type == Util::FeatureMatchingMethod::RANGE) {
+		tree->annkFRSearch( // search
+				query_point.values, // query point
+				square_radius, // square distance
+				k, // number of near neighbors
+				nnIdx.data(), // nearest neighbors (returned)
+				dists.data(), // distance (returned)
+				eps); // error bound
+
+		for (int i = 0; i < k; i++) {
+			dists[i] = sqrt(dists[i]);
+
+			if (nnIdx[i] >= 0 && nnIdx[i] != query_shape_id)
+				similar_shapes_indices.push_back({nnIdx[i], dists[i]});
+		}
+	}
+
+	// Without the query among the neighbors (an approximate search may miss it), one too many are left
+	if (search_type != Util::FeatureMatchingMethod::RANGE && similar_shapes_indices.size() > match_count)
+		similar_shapes_indices.resize(match_count);
+
+	return similar_shapes_indices;
+}
+
+void AnnIndex::fill_points(const FeatureStore &store) {
+	coordinates.assign((size_t) store.size() * FEATURE_VECTOR_STRIDE, 0.0);
+
+	for (int shape_id = 0; shape_id < store.size(); shape_id++) {
+		points[shape_id] = coordinates.data() + (size_t) shape_id * FEATURE_VECTOR_STRIDE;
+
+		FeatureMatching::scaled_features(store, shape_id, scales, points[shape_id]);
+	}
+}
+
+ANNkdStats AnnIndex::tree_statistics() const {
+	ANNkdStats statistics;
+	tree->getStats(statistics);
+	return statistics;
+}
+
+Util::AnnShrinkRule AnnIndex::shrink_rule_for(const DatabaseMetadata &metadata) {
+	return metadata.ann_tree == Util::AnnTree::BD_TREE ? metadata.ann_shrink_rule : Util::AnnShrinkRule::BD_NONE;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <ANN/ANN.h>
+#include <ANN/ANNperf.h>
+#include <array>
+#include <boost/align/aligned_allocator.hpp>
+#include <boost/filesystem.hpp>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "database_mr.h"
+#include "feature_matching.h"
+#include "feature_store.h"
+#include "top_k.h"
+#include "util.h"
+
+// ANN kd-tree or bd-tree over the feature vectors of a feature store, used by KNN, RNN and RANGE matching.
+// Coordinates are scaled as FeatureMatching::scaled_features() does, so the L1 distance ANN is compiled with equals
+// the squared STD distance (see FeatureMatching::get_feature_distance).
+// --build-index persists it next to the database; it is rebuilt when the shapes, statistics, weights or tree settings
+// it was built from change.
+class AnnIndex {
+public:
+	AnnIndex(const AnnIndex &) = delete;
+
+	AnnIndex &operator=(const AnnIndex &) = delete;
+
+	~AnnIndex();
+
+	static std::shared_ptr<const AnnIndex> build(const FeatureStore &store, const DatabaseMetadata &metadata);
+
+	// Returns nullptr if there is no index file, or if it was built from other data or weights than given
+	static std::shared_ptr<const AnnIndex> load(const boost::filesystem::path &path, const FeatureStore &store,
+	                                            const DatabaseMetadata &metadata);
+
+	static boost::filesystem::path index_path(const boost::filesystem::path &database_path);
+
+	bool save(const boost::filesystem::path &path) const;
+
+	bool matches(const FeatureStore &store, const DatabaseMetadata &metadata) const;
+
+	// Whether the coordinates were scaled with the weights of this metadata
+	bool is_weighted_for(const DatabaseMetadata &metadata) const;
+
+	ANNkdStats tree_statistics() const;
+
+	// Matches other than the shape the query is (query_shape_id, -1 if it is not in the store). Several threads may
+	// search at once, as the globals ANN keeps the state of a search in are thread_local.
+	std::vector<ShapeMatch> search(const FeatureVector &query, int query_shape_id, const DatabaseMetadata &metadata,
+	                               Util::FeatureMatchingMethod search_type) const;
+
+private:
+	// ANN shares an empty leaf between all trees, allocated by whichever is built or read first, so building,
+	// reading and destroying trees take turns
+	static std::mutex ann_mutex;
+
+	// One row of FEATURE_VECTOR_STRIDE coordinates per shape, each row starting on a FEATURE_STORE_ALIGNMENT boundary.
+	// points holds a pointer to every row, which is the form ANN takes points in.
+	std::vector<double, boost::alignment::aligned_allocator<double, FEATURE_STORE_ALIGNMENT>> coordinates;
+	ANNpointArray points = nullptr;
+	ANNkd_tree *tree = nullptr;
+
+	// What the index was built from
+	int shape_count = 0;
+	int64_t generation = 0;
+	uint64_t statistics_checksum = 0;
+	DimensionScales scales{};
+	Util::AnnTree tree_type = Util::AnnTree::KD_TREE;
+	Util::AnnSplitRule split_rule = Util::AnnSplitRule::KD_SUGGEST;
+	Util::AnnShrinkRule shrink_rule = Util::AnnShrinkRule::BD_NONE;
+
+	AnnIndex() = default;
+
+	// BD_NONE for kd-trees, which do not shrink whatever the metadata says
+	static Util::AnnShrinkRule shrink_rule_for(const DatabaseMetadata &metadata);
+
+	// Copies the scaled, sorted feature vectors of the store into coordinates, and points every entry of points at its
+	// row
+	void fill_points(const FeatureStore &store);
+};
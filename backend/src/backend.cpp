@@ -1,4 +1,6 @@
 #include "actions/authors.h"
+#include "actions/benchmark.h"
+#include "actions/build_index.h"
 #include "actions/evaluate.h"
 #include "actions/extract.h"
 #include "actions/normalize.h"
@@ -6,6 +8,7 @@
 #include "actions/store.h"
 #include "actions/version.h"
 #include "database_mr.h"
+#include "shards.h"
 #include <boost/program_options.hpp>
 #include <time.h>
 
@@ -18,12 +21,27 @@ static bool check_append_overwrite(const ActionArgs &aargs) {
 	return true;
 }
 
-static bool check_database(const ActionArgs &aargs) {
+static bool check_database(const ActionArgs &aargs, const boost::program_options::variables_map &vm) {
 	if (aargs.database.empty()) {
 		std::cout << "Required argument 'database' has not been provided." << std::endl;
 		return false;
 	}
 
+	if (aargs.databases.size() > 1) {
+		if (!vm.count("query") && !vm.count("store") && !vm.count("extract") && !vm.count("build-index")) {
+			std::cout << "Only --query, --store, --extract and --build-index accept more than one database."
+			          << std::endl;
+			return false;
+		}
+
+		for (const std::string &database : aargs.databases) {
+			if (!boost::filesystem::is_regular_file(database)) {
+				std::cout << "Database " << database << " does not exist." << std::endl;
+				return false;
+			}
+		}
+	}
+
 	boost::filesystem::path db_abs_path = boost::filesystem::absolute(aargs.database);
 
 	if (boost::filesystem::exists(db_abs_path)) {
@@ -42,7 +60,8 @@ static bool check_database(const ActionArgs &aargs) {
 
 static bool exactly_one_command(const boost::program_options::variables_map &vm) {
 	int count = 0;
-	const std::string commands[] = {"help", "version", "authors", "normalize", "extract", "store", "query", "evaluate"};
+	const std::string commands[] = {"help", "version", "authors", "normalize", "extract", "store", "query", "evaluate",
+	                                "build-index", "benchmark"};
 	for (const std::string &command : commands) {
 		if (vm.count(command)) {
 			count++;
@@ -65,7 +84,7 @@ int main(int argc, char **argv) {
 	/*
 	 * Exit codes:
 	 * 0: Everything is OK.
-	 * 1: Command-specific. (Input not found, or of incorrect type (file/directory), or queried input does not exist in database)
+	 * 1: Command-specific. (Input not found, or of incorrect type (file/directory), or queried input could not be read)
 	 * 2: Command-specific. (Cache directory/database file exists but may not be overwritten or changed, or is of incorrect type (file/directory))
 	 * 3: Command-specific. (No query result found)
 	 * 4: <Reserved.>
@@ -82,6 +101,8 @@ int main(int argc, char **argv) {
 	int exit_code = 9;
 
 	ActionArgs aargs = ActionArgs();
+	std::vector<std::string> database_arguments;
+	std::string ann_search_argument;
 
 	try {
 		boost::program_options::options_description desc{"Multimedia Retrieval Backend " + Version::version()};
@@ -95,22 +116,78 @@ int main(int argc, char **argv) {
 				 "\n./backend --normalize --database ./my_database.db [--append] [--overwrite] [--debug]")
 				("extract",
 				 "Extracts features from all files in originals directory."
+				 " Given more databases, extracts into the first and refreshes the feature snapshots and indexes of all"
+				 " of them for --query over the same databases."
 				 "\nUsage:"
-				 "\n./backend --extract --database ./my_database.db [--append] [--overwrite] [--debug]")
+				 "\n./backend --extract --database ./my_database.db [--database ./my_shard.db ...] [--append]"
+				 " [--overwrite] [--debug]")
 				("store", boost::program_options::value<std::string>(&aargs.input_file),
 				 "Normalize and extract in one command."
+				 " Given more databases, stores into the first and refreshes the feature snapshots and indexes of all"
+				 " of them for --query over the same databases."
 				 "\nUsage:"
-				 "\n./backend --store ./my_input_file.off --database ./my_database.db [--debug]")
+				 "\n./backend --store ./my_input_file.off --database ./my_database.db [--database ./my_shard.db ...]"
+				 " [--debug]")
 				("query", boost::program_options::value<std::string>(&aargs.input_file),
 				 "Query (normalize, extract and compare) an input file on a database."
 				 "Prints location and name of result, if any. Prints 'No match found.' otherwise."
+				 " A file that is not in the database is normalized and extracted in memory, without storing it."
+				 " Also takes a text file listing one input file per line, or '-' to read that list from stdin,"
+				 " and then prints one line per input file: its path and those of its results, separated by tabs."
+				 " Results are cached next to the first database under the name and contents of the input file, and"
+				 " reused without loading the databases' features until the databases or the matching settings change."
 				 "\nUsage:"
-				 "\n./backend --query ./my_input_file.off --database ./my_database.db [--debug]")
+				 "\n./backend --query ./my_input_file.off --database ./my_database.db [--database ./my_shard.db ...] [--debug]"
+				 "\n./backend --query ./my_query_list.txt --database ./my_database.db [--debug]")
 				("evaluate",
 				 "Evaluates the quality of the database."
 				 "\nUsage:"
 				 "\n./backend --evaluate --database ./my_database.db [--debug]")
-				("database", boost::program_options::value<std::string>(&aargs.database), "A database file.")
+				("build-index",
+				 "Builds the ANN index KNN, RNN and RANGE queries search, or the HNSW graph, PQ index or IVF index"
+				 " if the database's feature_matching_method is HNSW, PQ or IVF, and stores it next to the database."
+				 " Without one, every such query builds its own. The index is rebuilt automatically"
+				 " once shapes are added; shapes stored since are inserted into the HNSW graph or IVF lists."
+				 " Given more databases, builds one for each, normalized and weighted as --query over the same"
+				 " databases searches them."
+				 "\nUsage:"
+				 "\n./backend --build-index --database ./my_database.db [--database ./my_shard.db ...] [--debug]")
+				("benchmark",
+				 "Runs the feature matching microbenchmarks."
+				 " Given a database, also compares the ANN index, HNSW, GLOBAL, SQ8, PQ and IVF search settings and"
+				 " the STD scan thread count on its features."
+				 "\nUsage:"
+				 "\n./backend --benchmark [--database ./my_database.db]")
+				("database", boost::program_options::value<std::vector<std::string>>(&database_arguments)->composing(),
+				 "A database file, or a manifest listing one database file per line."
+				 " --query accepts several, given as repeated --database arguments or in a manifest.")
+				("ann-eps", boost::program_options::value<double>(),
+				 "Overrides the database's ann_eps for --query and --evaluate: KNN and RNN matches may be up to"
+				 " (1 + eps) times as far as the true ones.")
+				("ann-search", boost::program_options::value<std::string>(&ann_search_argument),
+				 "Overrides the database's ann_search_strategy for --query and --evaluate: STANDARD or PRIORITY.")
+				("ann-max-points", boost::program_options::value<int>(),
+				 "Overrides the database's ann_max_points_visited for --query and --evaluate: KNN and RNN searches"
+				 " stop after visiting this many shapes. 0 for no limit.")
+				("hnsw-ef-search", boost::program_options::value<int>(),
+				 "Overrides the database's hnsw_ef_search for --query and --evaluate: HNSW searches keep this many"
+				 " candidates. Higher finds more of the true matches, more slowly.")
+				("candidate-pool-multiplier", boost::program_options::value<int>(),
+				 "Overrides the database's candidate_pool_multiplier for --query and --evaluate: GLOBAL, SQ8 and PQ"
+				 " searches rerank this many times the returned match count exactly.")
+				("scan-threads", boost::program_options::value<int>(),
+				 "Overrides the database's scan_thread_count for --query and --evaluate: STD searches split the"
+				 " database over this many threads. 0 for one per core, or fewer for small databases.")
+				("ivf-probes", boost::program_options::value<int>(),
+				 "Overrides the database's ivf_probe_count for --query and --evaluate: IVF searches rank the shapes"
+				 " in this many of the index's lists. Higher finds more of the true matches, more slowly.")
+				("page", boost::program_options::value<int>(),
+				 "For --query with RANGE matching, which returns every match within maximum_feature_matching_distance:"
+				 " prints only page n (counting from 0) of maximum_returned_matches matches.")
+				("query-samples", boost::program_options::value<int>(),
+				 "For --query of meshes that are not in the database: extracts each histogram from this many random"
+				 " samples instead of the 1000000 the database was extracted with. Fewer answer sooner, with noisier"
+				 " features.")
 				("append", "Allows for appending to (and thus changing) the database")
 				("overwrite", "Allows overwriting the cache directory/database file.")
 				("debug", "Allows printing of debug info.");
@@ -119,43 +196,84 @@ int main(int argc, char **argv) {
 		boost::program_options::store(parse_command_line(argc, argv, desc), vm);
 		notify(vm);
 
+		aargs.databases = Shards::expand(database_arguments);
+		aargs.database = aargs.databases.empty() ? "" : aargs.databases[0];
 		aargs.append = vm.count("append");
 		aargs.overwrite = vm.count("overwrite");
 		aargs.debug = vm.count("debug");
 
+		if (vm.count("ann-eps"))
+			aargs.ann_eps = vm["ann-eps"].as<double>();
+
+		if (vm.count("ann-search")) {
+			Util::AnnSearchStrategy ann_search_strategy;
+			if (!Util::EnumFromString(ann_search_argument, Util::PRIORITY, ann_search_strategy))
+				throw boost::program_options::invalid_option_value(ann_search_argument);
+
+			aargs.ann_search_strategy = ann_search_strategy;
+		}
+
+		if (vm.count("ann-max-points"))
+			aargs.ann_max_points_visited = vm["ann-max-points"].as<int>();
+
+		if (vm.count("hnsw-ef-search"))
+			aargs.hnsw_ef_search = vm["hnsw-ef-search"].as<int>();
+
+		if (vm.count("candidate-pool-multiplier"))
+			aargs.candidate_pool_multiplier = vm["candidate-pool-multiplier"].as<int>();
+
+		if (vm.count("scan-threads"))
+			aargs.scan_thread_count = vm["scan-threads"].as<int>();
+
+		if (vm.count("ivf-probes"))
+			aargs.ivf_probe_count = vm["ivf-probes"].as<int>();
+
+		if (vm.count("page"))
+			aargs.page = vm["page"].as<int>();
+
+		if (vm.count("query-samples"))
+			aargs.query_sample_count = vm["query-samples"].as<int>();
+
 		if (argc == 1 || vm.count("help")) {
 			std::cout << desc << '\n';
 			exit_code = 0;
 		} else if (!exactly_one_command(vm)) {
 			std::cout << "No or multiple commands provided." << std::endl;
 			std::cout << "Please provide exactly one of the following:" << std::endl;
-			std::cout << "--help, --version, --authors, --normalize, --extract, --store, --query --evaluate" << std::endl;
+			std::cout << "--help, --version, --authors, --normalize, --extract, --store, --query, --evaluate,"
+			             " --build-index, --benchmark" << std::endl;
 			exit_code = 6;
 		} else {
 			if (vm.count("version")) {
 				exit_code = Version::run(aargs);
 			} else if (vm.count("authors")) {
 				exit_code = Authors::run(aargs);
+			} else if (vm.count("benchmark")) {
+				exit_code = Benchmark::run(aargs);
 			} else if (!check_append_overwrite(aargs)) {
 				exit_code = 7;
-			} else if (!check_database(aargs)) {
+			} else if (!check_database(aargs, vm)) {
 				exit_code = 8;
+			} else if (vm.count("query")) {
+				// Opens every shard itself, read-only
+				exit_code = Query::run(aargs);
 			} else {
-				Database::open(boost::filesystem::absolute(aargs.database).c_str());
+				Database database;
+				database.open(boost::filesystem::absolute(aargs.database));
 
 				if (vm.count("normalize")) {
-					exit_code = Normalize::run(aargs);
+					exit_code = Normalize::run(aargs, database);
 				} else if (vm.count("extract")) {
-					exit_code = Extract::run(aargs);
+					exit_code = Extract::run(aargs, database);
 				} else if (vm.count("store")) {
-					exit_code = Store::run(aargs);
-				} else if (vm.count("query")) {
-					exit_code = Query::run(aargs);
+					exit_code = Store::run(aargs, database);
 				} else if (vm.count("evaluate")) {
-					exit_code = Evaluate::run(aargs);
+					exit_code = Evaluate::run(aargs, database);
+				} else if (vm.count("build-index")) {
+					exit_code = BuildIndex::run(aargs, database);
 				}
 
-				Database::close();
+				database.close();
 			}
 		}
 	} catch (const boost::program_options::error &ex) {
@@ -0,0 +1,432 @@
+#include "benchmarks.h"
+
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <thread>
+#include "../thirdparty/Wasserstein/wasserstein.h"
+#include "ann_index.h"
+#include "config.h"
+#include "emd.h"
+#include "feature_matching.h"
+#include "hnsw_index.h"
+#include "ivf_index.h"
+#include "pq_index.h"
+
+static double seconds_since(const std::chrono::steady_clock::time_point &start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+std::vector<BenchmarkResult> Benchmarks::emd(int pair_count) {
+	const std::vector<double> histograms_a = random_histograms(pair_count, 1);
+	const std::vector<double> histograms_b = random_histograms(pair_count, 2);
+
+	std::vector<double> expected(pair_count);
+	std::vector<double> actual(pair_count);
+
+	// The generic version, called the way feature matching used to call it
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	for (int i = 0; i < pair_count; i++) {
+		const double *a = histograms_a.data() + i * HISTOGRAM_BAR_COUNT;
+		const double *b = histograms_b.data() + i * HISTOGRAM_BAR_COUNT;
+
+		std::vector<double> weight(HISTOGRAM_BAR_COUNT, 1.0 / HISTOGRAM_BAR_COUNT);
+		std::vector<double> histogram_a(a, a + HISTOGRAM_BAR_COUNT);
+		std::vector<double> histogram_b(b, b + HISTOGRAM_BAR_COUNT);
+
+		expected[i] = std::wasserstein(histogram_a, weight, histogram_b, weight);
+	}
+
+	BenchmarkResult generic;
+	generic.name = "wasserstein";
+	generic.iterations = pair_count;
+	generic.seconds = seconds_since(start);
+
+	start = std::chrono::steady_clock::now();
+
+	for (int i = 0; i < pair_count; i++) {
+		actual[i] = Emd::histogram_distance(histograms_a.data() + i * HISTOGRAM_BAR_COUNT,
+		                                    histograms_b.data() + i * HISTOGRAM_BAR_COUNT);
+	}
+
+	BenchmarkResult kernel;
+	kernel.name = "Emd::histogram_distance";
+	kernel.iterations = pair_count;
+	kernel.seconds = seconds_since(start);
+
+	for (int i = 0; i < pair_count; i++)
+		kernel.max_difference = std::max(kernel.max_difference, std::abs(expected[i] - actual[i]));
+
+	// Histograms sorted up front, as the feature store holds them
+	std::vector<double> sorted_a(histograms_a.size());
+	std::vector<double> sorted_b(histograms_b.size());
+
+	for (int i = 0; i < pair_count; i++) {
+		Emd::sort_histogram(histograms_a.data() + i * HISTOGRAM_BAR_COUNT, sorted_a.data() + i * HISTOGRAM_BAR_COUNT);
+		Emd::sort_histogram(histograms_b.data() + i * HISTOGRAM_BAR_COUNT, sorted_b.data() + i * HISTOGRAM_BAR_COUNT);
+	}
+
+	start = std::chrono::steady_clock::now();
+
+	for (int i = 0; i < pair_count; i++) {
+		actual[i] = Emd::quantile_distance(sorted_a.data() + i * HISTOGRAM_BAR_COUNT,
+		                                   sorted_b.data() + i * HISTOGRAM_BAR_COUNT);
+	}
+
+	BenchmarkResult presorted;
+	presorted.name = "Emd::quantile_distance (presorted)";
+	presorted.iterations = pair_count;
+	presorted.seconds = seconds_since(start);
+
+	for (int i = 0; i < pair_count; i++)
+		presorted.max_difference = std::max(presorted.max_difference, std::abs(expected[i] - actual[i]));
+
+	return {generic, kernel, presorted};
+}
+
+std::vector<IndexBenchmarkResult>
+Benchmarks::ann_index(const FeatureStore &store, const DatabaseMetadata &metadata, int query_count) {
+	std::vector<DatabaseMetadata> configurations;
+
+	for (int split_rule = Util::KD_STD; split_rule <= Util::KD_SUGGEST; split_rule++) {
+		DatabaseMetadata configuration = metadata;
+		configuration.ann_tree = Util::AnnTree::KD_TREE;
+		configuration.ann_split_rule = (Util::AnnSplitRule) split_rule;
+		configurations.push_back(configuration);
+	}
+
+	for (int shrink_rule = Util::BD_SIMPLE; shrink_rule <= Util::BD_SUGGEST; shrink_rule++) {
+		DatabaseMetadata configuration = metadata;
+		configuration.ann_tree = Util::AnnTree::BD_TREE;
+		configuration.ann_split_rule = Util::AnnSplitRule::KD_SUGGEST;
+		configuration.ann_shrink_rule = (Util::AnnShrinkRule) shrink_rule;
+		configurations.push_back(configuration);
+	}
+
+	std::vector<FeatureVector> queries;
+
+	for (int shape_id : sample_shapes(store, query_count))
+		queries.push_back(store.feature_vector(shape_id));
+
+	const boost::filesystem::path file_path = boost::filesystem::temp_directory_path()
+	                                          / boost::filesystem::unique_path("%%%%-%%%%-%%%%.kdtree");
+
+	std::vector<std::vector<ShapeMatch>> expected;
+	std::vector<IndexBenchmarkResult> results;
+
+	for (const DatabaseMetadata &configuration : configurations) {
+		IndexBenchmarkResult result;
+		result.name = Util::ToString(configuration.ann_tree) + " " + Util::ToString(configuration.ann_split_rule);
+		if (configuration.ann_tree == Util::AnnTree::BD_TREE)
+			result.name += " " + Util::ToString(configuration.ann_shrink_rule);
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		const std::shared_ptr<const AnnIndex> index = AnnIndex::build(store, configuration);
+		result.build_seconds = seconds_since(start);
+
+		if (index->save(file_path)) {
+			result.file_size = boost::filesystem::file_size(file_path);
+			boost::filesystem::remove(file_path);
+		}
+
+		const ANNkdStats statistics = index->tree_statistics();
+		result.leaf_count = statistics.n_lf;
+		result.split_count = statistics.n_spl;
+		result.shrink_count = statistics.n_shr;
+		result.depth = statistics.depth;
+
+		std::vector<std::vector<ShapeMatch>> matches(queries.size());
+		start = std::chrono::steady_clock::now();
+
+		for (int i = 0; i < queries.size(); i++)
+			matches[i] = index->search(queries[i], -1, configuration, Util::FeatureMatchingMethod::KNN);
+
+		result.query_count = queries.size();
+		result.query_seconds = seconds_since(start);
+
+		if (expected.empty())
+			expected = matches;
+
+		for (int i = 0; i < queries.size(); i++) {
+			for (int j = 0; j < matches[i].size() && j < expected[i].size(); j++)
+				result.max_difference = std::max(result.max_difference,
+				                                 std::abs(matches[i][j].distance - expected[i][j].distance));
+		}
+
+		results.push_back(result);
+	}
+
+	return results;
+}
+
+std::vector<SearchBenchmarkResult>
+Benchmarks::hnsw_index(const FeatureStore &store, const DatabaseMetadata &metadata, int query_count) {
+	std::vector<FeatureVector> queries;
+
+	for (int shape_id : sample_shapes(store, query_count))
+		queries.push_back(store.feature_vector(shape_id));
+
+	DatabaseMetadata exact_configuration = metadata;
+	exact_configuration.ann_eps = 0;
+	exact_configuration.ann_max_points_visited = 0;
+	const std::shared_ptr<const AnnIndex> exact_index = AnnIndex::build(store, exact_configuration);
+
+	std::vector<std::vector<ShapeMatch>> expected;
+
+	for (const FeatureVector &query : queries)
+		expected.push_back(exact_index->search(query, -1, exact_configuration, Util::FeatureMatchingMethod::KNN));
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	const std::shared_ptr<const HnswIndex> index = HnswIndex::build(store, metadata);
+	const double build_seconds = seconds_since(start);
+
+	const boost::filesystem::path file_path = boost::filesystem::temp_directory_path()
+	                                          / boost::filesystem::unique_path("%%%%-%%%%-%%%%.hnsw");
+	size_t file_size = 0;
+
+	if (index->save(file_path)) {
+		file_size = boost::filesystem::file_size(file_path);
+		boost::filesystem::remove(file_path);
+	}
+
+	std::vector<SearchBenchmarkResult> results;
+
+	const int k = std::max(1, metadata.maximum_returned_matches);
+
+	for (int ef_search = k; ef_search <= 16 * k; ef_search *= 2) {
+		DatabaseMetadata configuration = metadata;
+		configuration.hnsw_ef_search = ef_search;
+
+		SearchBenchmarkResult result;
+		result.name = "ef_search " + std::to_string(ef_search);
+		result.build_seconds = build_seconds;
+		result.file_size = file_size;
+
+		std::vector<std::vector<ShapeMatch>> matches(queries.size());
+		start = std::chrono::steady_clock::now();
+
+		for (int i = 0; i < queries.size(); i++)
+			matches[i] = index->search(queries[i], -1, configuration);
+
+		result.query_count = queries.size();
+		result.query_seconds = seconds_since(start);
+
+		result.recall = recall(expected, matches);
+		results.push_back(result);
+	}
+
+	return results;
+}
+
+std::vector<SearchBenchmarkResult>
+Benchmarks::reranked_search(const FeatureStore &store, const DatabaseMetadata &metadata, int query_count) {
+	const std::vector<int> shape_ids = sample_shapes(store, query_count);
+	std::vector<SearchBenchmarkResult> results(1);
+
+	results[0].name = "STD";
+	const std::vector<std::vector<ShapeMatch>> expected = run_queries(store, metadata, Util::FeatureMatchingMethod::STD,
+	                                                                  shape_ids, results[0]);
+	results[0].recall = 1.0;
+
+	FeatureStore indexed_store = store;
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	indexed_store.build_index_if_needed(metadata, Util::FeatureMatchingMethod::PQ);
+	const double pq_build_seconds = seconds_since(start);
+
+	const boost::filesystem::path file_path = boost::filesystem::temp_directory_path()
+	                                          / boost::filesystem::unique_path("%%%%-%%%%-%%%%.pq");
+	size_t pq_file_size = 0;
+
+	if (indexed_store.pq_index()->save(file_path)) {
+		pq_file_size = boost::filesystem::file_size(file_path);
+		boost::filesystem::remove(file_path);
+	}
+
+	for (Util::FeatureMatchingMethod method : {Util::FeatureMatchingMethod::GLOBAL, Util::FeatureMatchingMethod::SQ8,
+	                                            Util::FeatureMatchingMethod::PQ}) {
+		for (int candidate_pool_multiplier = 1; candidate_pool_multiplier <= 8; candidate_pool_multiplier *= 2) {
+			DatabaseMetadata configuration = metadata;
+			configuration.candidate_pool_multiplier = candidate_pool_multiplier;
+
+			SearchBenchmarkResult result;
+			result.name = Util::ToString(method) + " candidate_pool_multiplier "
+			              + std::to_string(candidate_pool_multiplier);
+
+			if (method == Util::FeatureMatchingMethod::PQ) {
+				result.build_seconds = pq_build_seconds;
+				result.file_size = pq_file_size;
+			}
+
+			result.recall = recall(expected, run_queries(indexed_store, configuration, method, shape_ids, result));
+			results.push_back(result);
+		}
+	}
+
+	return results;
+}
+
+std::vector<SearchBenchmarkResult>
+Benchmarks::ivf_index(const FeatureStore &store, const DatabaseMetadata &metadata, int query_count) {
+	const std::vector<int> shape_ids = sample_shapes(store, query_count);
+	std::vector<SearchBenchmarkResult> results(1);
+
+	results[0].name = "STD";
+	const std::vector<std::vector<ShapeMatch>> expected = run_queries(store, metadata, Util::FeatureMatchingMethod::STD,
+	                                                                  shape_ids, results[0]);
+	results[0].recall = 1.0;
+
+	FeatureStore indexed_store = store;
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	indexed_store.build_index_if_needed(metadata, Util::FeatureMatchingMethod::IVF);
+	const double build_seconds = seconds_since(start);
+
+	const boost::filesystem::path file_path = boost::filesystem::temp_directory_path()
+	                                          / boost::filesystem::unique_path("%%%%-%%%%-%%%%.ivf");
+	size_t file_size = 0;
+
+	if (indexed_store.ivf_index()->save(file_path)) {
+		file_size = boost::filesystem::file_size(file_path);
+		boost::filesystem::remove(file_path);
+	}
+
+	const int list_count = indexed_store.ivf_index()->list_count();
+
+	for (int probe_count = 1; probe_count < 2 * list_count; probe_count *= 2) {
+		DatabaseMetadata configuration = metadata;
+		configuration.ivf_probe_count = std::min(probe_count, list_count);
+
+		SearchBenchmarkResult result;
+		result.name = "ivf_probe_count " + std::to_string(configuration.ivf_probe_count) + " of "
+		              + std::to_string(list_count);
+		result.build_seconds = build_seconds;
+		result.file_size = file_size;
+
+		result.recall = recall(expected, run_queries(indexed_store, configuration, Util::FeatureMatchingMethod::IVF,
+		                                             shape_ids, result));
+		results.push_back(result);
+	}
+
+	return results;
+}
+
+std::vector<BenchmarkResult>
+Benchmarks::scan_threads(const FeatureStore &store, const DatabaseMetadata &metadata, int query_count) {
+	const std::vector<int> shape_ids = sample_shapes(store, query_count);
+	const int core_count = std::max(1, (int) std::thread::hardware_concurrency());
+
+	std::vector<int> thread_counts;
+
+	for (int thread_count = 1; thread_count < core_count; thread_count *= 2)
+		thread_counts.push_back(thread_count);
+
+	thread_counts.push_back(core_count);
+
+	std::vector<BenchmarkResult> results;
+	std::vector<std::vector<ShapeMatch>> expected;
+
+	for (int thread_count : thread_counts) {
+		DatabaseMetadata configuration = metadata;
+		configuration.scan_thread_count = thread_count;
+
+		SearchBenchmarkResult search_result;
+		const std::vector<std::vector<ShapeMatch>> matches = run_queries(store, configuration,
+		                                                                 Util::FeatureMatchingMethod::STD, shape_ids,
+		                                                                 search_result);
+
+		BenchmarkResult result;
+		result.name = std::to_string(thread_count) + (thread_count == 1 ? " thread" : " threads");
+		result.iterations = search_result.query_count;
+		result.seconds = search_result.query_seconds;
+
+		if (expected.empty())
+			expected = matches;
+
+		// Any other shape than a single thread finds is an infinite difference
+		for (int i = 0; i < matches.size(); i++) {
+			if (matches[i].size() != expected[i].size()) {
+				result.max_difference = INFINITY;
+				continue;
+			}
+
+			for (int j = 0; j < matches[i].size(); j++) {
+				const double difference = matches[i][j].shape_id == expected[i][j].shape_id
+				                          ? std::abs(matches[i][j].distance - expected[i][j].distance) : INFINITY;
+				result.max_difference = std::max(result.max_difference, difference);
+			}
+		}
+
+		results.push_back(result);
+	}
+
+	return results;
+}
+
+std::vector<int> Benchmarks::sample_shapes(const FeatureStore &store, int query_count) {
+	query_count = std::min(query_count, store.size());
+	std::vector<int> shape_ids;
+
+	for (int i = 0; i < query_count; i++)
+		shape_ids.push_back((int) ((long long) i * store.size() / query_count));
+
+	return shape_ids;
+}
+
+std::vector<std::vector<ShapeMatch>>
+Benchmarks::run_queries(const FeatureStore &store, const DatabaseMetadata &metadata,
+                        Util::FeatureMatchingMethod method, const std::vector<int> &shape_ids,
+                        SearchBenchmarkResult &result) {
+	std::vector<std::vector<ShapeMatch>> matches(shape_ids.size());
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	for (int i = 0; i < shape_ids.size(); i++)
+		matches[i] = FeatureMatching::get_similar_shapes(store.feature_vector(shape_ids[i]), shape_ids[i], store,
+		                                                 metadata, method);
+
+	result.query_count = shape_ids.size();
+	result.query_seconds = seconds_since(start);
+	return matches;
+}
+
+double Benchmarks::recall(const std::vector<std::vector<ShapeMatch>> &expected,
+                          const std::vector<std::vector<ShapeMatch>> &matches) {
+	double total_recall = 0;
+
+	for (int i = 0; i < expected.size(); i++) {
+		int found = 0;
+
+		for (const ShapeMatch &expected_match : expected[i])
+			for (const ShapeMatch &match : matches[i])
+				if (match.shape_id == expected_match.shape_id) {
+					found++;
+					break;
+				}
+
+		total_recall += expected[i].empty() ? 1.0 : (double) found / expected[i].size();
+	}
+
+	return expected.empty() ? 1.0 : total_recall / expected.size();
+}
+
+std::vector<double> Benchmarks::random_histograms(int histogram_count, unsigned int seed) {
+	std::mt19937 generator(seed);
+	std::uniform_real_distribution<double> distribution(0.0, 1.0);
+
+	// Normalized like the histograms of the feature extraction, so the bars of each histogram sum to 1
+	std::vector<double> histograms(histogram_count * HISTOGRAM_BAR_COUNT);
+
+	for (int i = 0; i < histogram_count; i++) {
+		double *histogram = histograms.data() + i * HISTOGRAM_BAR_COUNT;
+		double sum = 0;
+
+		for (int bar = 0; bar < HISTOGRAM_BAR_COUNT; bar++) {
+			histogram[bar] = distribution(generator);
+			sum += histogram[bar];
+		}
+
+		for (int bar = 0; bar < HISTOGRAM_BAR_COUNT; bar++)
+			histogram[bar] /= sum;
+	}
+
+	return histograms;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "database_mr.h"
+#include "feature_store.h"
+#include "top_k.h"
+
+struct BenchmarkResult {
+	std::string name;
+	int iterations{};
+	double seconds{};
+	double max_difference{}; // Largest difference from the results of the first entry of the same benchmark
+};
+
+struct IndexBenchmarkResult {
+	std::string name;
+	double build_seconds{};
+	size_t file_size{}; // Of the index as --build-index stores it
+	int leaf_count{};
+	int split_count{};
+	int shrink_count{};
+	int depth{};
+	int query_count{};
+	double query_seconds{};
+	double max_difference{}; // Largest difference from the match distances of the first entry
+};
+
+struct SearchBenchmarkResult {
+	std::string name;
+	double build_seconds{}; // Of the index searched, if any
+	size_t file_size{}; // Of the index as it is stored
+	int query_count{};
+	double query_seconds{};
+	double recall{}; // Mean fraction of the exact nearest shapes found
+};
+
+// Microbenchmarks for the hot paths of feature matching. Inputs are generated from a fixed seed.
+class Benchmarks {
+public:
+	// Generic wasserstein() against the fixed-size Emd kernel, and against the L1 form on presorted histograms
+	static std::vector<BenchmarkResult> emd(int pair_count);
+
+	// Every ANN tree and split/shrink rule, built over the store and queried with KNN for query_count of its shapes
+	static std::vector<IndexBenchmarkResult>
+	ann_index(const FeatureStore &store, const DatabaseMetadata &metadata, int query_count);
+
+	// The HNSW graph built with the metadata's settings, queried for query_count of the store's shapes with a range of
+	// hnsw_ef_search values; recall is against an exact search in the same space
+	static std::vector<SearchBenchmarkResult>
+	hnsw_index(const FeatureStore &store, const DatabaseMetadata &metadata, int query_count);
+
+	// The STD scan against GLOBAL, SQ8 and PQ (with the PQ index built in memory) for a range of
+	// candidate_pool_multiplier values, each for query_count of the store's shapes; recall is against STD
+	static std::vector<SearchBenchmarkResult>
+	reranked_search(const FeatureStore &store, const DatabaseMetadata &metadata, int query_count);
+
+	// The STD scan against IVF (with the index built in memory) probing 1, 2, 4, ... of its lists, each for query_count
+	// of the store's shapes; recall is against STD
+	static std::vector<SearchBenchmarkResult>
+	ivf_index(const FeatureStore &store, const DatabaseMetadata &metadata, int query_count);
+
+	// The STD scan split over 1, 2, 4, ... threads up to one per core, each for query_count of the store's shapes
+	static std::vector<BenchmarkResult>
+	scan_threads(const FeatureStore &store, const DatabaseMetadata &metadata, int query_count);
+
+private:
+	// Ids of query_count shapes spread over the store, so every class of shapes is queried
+	static std::vector<int> sample_shapes(const FeatureStore &store, int query_count);
+
+	// Queries the shapes with get_similar_shapes(), recording the query count and time in result
+	static std::vector<std::vector<ShapeMatch>>
+	run_queries(const FeatureStore &store, const DatabaseMetadata &metadata, Util::FeatureMatchingMethod method,
+	            const std::vector<int> &shape_ids, SearchBenchmarkResult &result);
+
+	// Mean fraction of the expected matches of a query among its matches
+	static double recall(const std::vector<std::vector<ShapeMatch>> &expected,
+	                     const std::vector<std::vector<ShapeMatch>> &matches);
+
+	static std::vector<double> random_histograms(int histogram_count, unsigned int seed);
+};
@@ -6,11 +6,23 @@ static const int VERSION_MAJOR = 0;
 static const int VERSION_MINOR = 8;
 
 static const bool PRINT_DB_ERRORS = true;
+static const int DATABASE_BUSY_TIMEOUT_MS = 10000; // How long a connection waits on another process's lock
 
 static const int REMESHING_TARGET_VERTEX_COUNT = 10000;
 static const int HISTOGRAM_BAR_COUNT = 10;
 static const int ITEMS_IN_HISTOGRAM_COUNT = 1000000;
 
+static const int GLOBAL_DESCRIPTOR_COUNT = 5;
+static const int PROPERTY_DESCRIPTOR_COUNT = 5;
+static const int FEATURE_VECTOR_DIMENSION = GLOBAL_DESCRIPTOR_COUNT + PROPERTY_DESCRIPTOR_COUNT * HISTOGRAM_BAR_COUNT;
+static const int FEATURE_STORE_ALIGNMENT = 64; // Cache line size
+// FEATURE_VECTOR_DIMENSION rounded up to a whole number of FEATURE_STORE_ALIGNMENT blocks, as indexes lay out points
+static const int FEATURE_VECTOR_STRIDE = (FEATURE_VECTOR_DIMENSION * sizeof(double) + FEATURE_STORE_ALIGNMENT - 1)
+                                         / FEATURE_STORE_ALIGNMENT * FEATURE_STORE_ALIGNMENT / sizeof(double);
+// Bytes per row of 8-bit feature codes: FEATURE_VECTOR_DIMENSION rounded up the same way
+static const int FEATURE_CODE_STRIDE = (FEATURE_VECTOR_DIMENSION + FEATURE_STORE_ALIGNMENT - 1)
+                                       / FEATURE_STORE_ALIGNMENT * FEATURE_STORE_ALIGNMENT;
+
 static const bool INCLUDE_FEATURE_SURFACE_AREA = true;
 static const bool INCLUDE_FEATURE_COMPACTNESS = true;
 static const bool INCLUDE_FEATURE_VOLUME = true;
@@ -7,12 +7,22 @@ const std::string DEFAULT_ORIGINALS_DIR = "./originals";
 const std::string DEFAULT_CACHE_DIR = "./cache";
 const int DEFAULT_MAXIMUM_RETURNED_MATCHES = 25;
 const double DEFAULT_MAXIMUM_FEATURE_MATCHING_DISTANCE = 0.5;
-
-SQLite::Database Database::db(""); // TODO bit hack-y; exceptions not caught
+const Util::AnnSearchStrategy DEFAULT_ANN_SEARCH_STRATEGY = Util::AnnSearchStrategy::STANDARD;
+const Util::AnnTree DEFAULT_ANN_TREE = Util::AnnTree::KD_TREE;
+const Util::AnnSplitRule DEFAULT_ANN_SPLIT_RULE = Util::AnnSplitRule::KD_SUGGEST;
+const Util::AnnShrinkRule DEFAULT_ANN_SHRINK_RULE = Util::AnnShrinkRule::BD_SUGGEST;
+const int DEFAULT_HNSW_M = 16;
+const int DEFAULT_HNSW_EF_CONSTRUCTION = 200;
+const int DEFAULT_HNSW_EF_SEARCH = 64;
+const int DEFAULT_CANDIDATE_POOL_MULTIPLIER = 4;
+const int DEFAULT_SCAN_THREAD_COUNT = 0;
+const int DEFAULT_QUERY_CACHE_CAPACITY = 1024;
+const int DEFAULT_IVF_LIST_COUNT = 0;
+const int DEFAULT_IVF_PROBE_COUNT = 8;
 
 int Database::create(const boost::filesystem::path &database_path) {
 	try {
-		db = SQLite::Database(database_path.string(), SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE);
+		SQLite::Database db(database_path.string(), SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE);
 	}
 	catch (std::exception &e) {
 		if (PRINT_DB_ERRORS) {
@@ -24,16 +34,24 @@ int Database::create(const boost::filesystem::path &database_path) {
 }
 
 int Database::open(const boost::filesystem::path &database_path) {
+	close();
+
 	try {
-		db = SQLite::Database(database_path.string(), SQLite::OPEN_READWRITE);
+		writer.reset(new SQLite::Database(database_path.string(), SQLite::OPEN_READWRITE, DATABASE_BUSY_TIMEOUT_MS));
+
+		// In WAL mode readers see the last committed state while a write is in progress, instead of waiting for it
+		writer->exec("PRAGMA journal_mode = WAL;");
 	}
 	catch (std::exception &e) {
 		if (PRINT_DB_ERRORS) {
 			std::cout << "SQLite exception: " << e.what() << std::endl;
 		}
+		writer.reset();
 		return EXIT_FAILURE;
 	}
 
+	this->database_path = database_path;
+
 	if (create_metadata_table_if_needed()) {
 		DatabaseMetadata metadata = DatabaseMetadata();
 		metadata.backend_version_major = VERSION_MAJOR;
@@ -60,16 +78,146 @@ int Database::open(const boost::filesystem::path &database_path) {
 		metadata.weight_D3 = 0.1;
 		metadata.weight_D4 = 0.1;
 
+		metadata.generation = 0;
+
+		metadata.ann_eps = 0;
+		metadata.ann_search_strategy = DEFAULT_ANN_SEARCH_STRATEGY;
+		metadata.ann_max_points_visited = 0;
+
+		metadata.ann_tree = DEFAULT_ANN_TREE;
+		metadata.ann_split_rule = DEFAULT_ANN_SPLIT_RULE;
+		metadata.ann_shrink_rule = DEFAULT_ANN_SHRINK_RULE;
+
+		metadata.hnsw_m = DEFAULT_HNSW_M;
+		metadata.hnsw_ef_construction = DEFAULT_HNSW_EF_CONSTRUCTION;
+		metadata.hnsw_ef_search = DEFAULT_HNSW_EF_SEARCH;
+
+		metadata.candidate_pool_multiplier = DEFAULT_CANDIDATE_POOL_MULTIPLIER;
+
+		metadata.scan_thread_count = DEFAULT_SCAN_THREAD_COUNT;
+
+		metadata.query_cache_capacity = DEFAULT_QUERY_CACHE_CAPACITY;
+
+		metadata.ivf_list_count = DEFAULT_IVF_LIST_COUNT;
+		metadata.ivf_probe_count = DEFAULT_IVF_PROBE_COUNT;
+
 		update_metadata(metadata);
 	}
 
+	// Columns added after the first release; new columns are appended so older databases keep their layout
+	add_column_if_needed("metadata", "generation", "INTEGER NOT NULL DEFAULT 0");
+	add_column_if_needed("metadata", "ann_eps", "REAL NOT NULL DEFAULT 0");
+	add_column_if_needed("metadata", "ann_search_strategy",
+	                     "TEXT NOT NULL DEFAULT '" + Util::ToString(DEFAULT_ANN_SEARCH_STRATEGY) + "'");
+	add_column_if_needed("metadata", "ann_max_points_visited", "INTEGER NOT NULL DEFAULT 0");
+	add_column_if_needed("metadata", "ann_tree", "TEXT NOT NULL DEFAULT '" + Util::ToString(DEFAULT_ANN_TREE) + "'");
+	add_column_if_needed("metadata", "ann_split_rule",
+	                     "TEXT NOT NULL DEFAULT '" + Util::ToString(DEFAULT_ANN_SPLIT_RULE) + "'");
+	add_column_if_needed("metadata", "ann_shrink_rule",
+	                     "TEXT NOT NULL DEFAULT '" + Util::ToString(DEFAULT_ANN_SHRINK_RULE) + "'");
+	add_column_if_needed("metadata", "hnsw_m", "INTEGER NOT NULL DEFAULT " + to_string(DEFAULT_HNSW_M));
+	add_column_if_needed("metadata", "hnsw_ef_construction",
+	                     "INTEGER NOT NULL DEFAULT " + to_string(DEFAULT_HNSW_EF_CONSTRUCTION));
+	add_column_if_needed("metadata", "hnsw_ef_search", "INTEGER NOT NULL DEFAULT " + to_string(DEFAULT_HNSW_EF_SEARCH));
+	add_column_if_needed("metadata", "candidate_pool_multiplier",
+	                     "INTEGER NOT NULL DEFAULT " + to_string(DEFAULT_CANDIDATE_POOL_MULTIPLIER));
+	add_column_if_needed("metadata", "scan_thread_count",
+	                     "INTEGER NOT NULL DEFAULT " + to_string(DEFAULT_SCAN_THREAD_COUNT));
+	add_column_if_needed("metadata", "query_cache_capacity",
+	                     "INTEGER NOT NULL DEFAULT " + to_string(DEFAULT_QUERY_CACHE_CAPACITY));
+	add_column_if_needed("metadata", "ivf_list_count", "INTEGER NOT NULL DEFAULT " + to_string(DEFAULT_IVF_LIST_COUNT));
+	add_column_if_needed("metadata", "ivf_probe_count",
+	                     "INTEGER NOT NULL DEFAULT " + to_string(DEFAULT_IVF_PROBE_COUNT));
+
 	create_shapes_table_if_needed();
 
+	bool sorted_histograms_added = drop_normalized_columns_if_needed();
+	for (const std::string column : {"a3_sorted", "d1_sorted", "d2_sorted", "d3_sorted", "d4_sorted"})
+		sorted_histograms_added |= add_column_if_needed("shapes", column, "TEXT NOT NULL DEFAULT ''");
+
+	if (sorted_histograms_added)
+		backfill_sorted_histograms();
+
+	if (create_statistics_table_if_needed()) {
+		// Databases from before the statistics table existed get their statistics computed once here
+		DatabaseStatistics database_statistics = DatabaseStatistics();
+
+		for (const DatabaseShape &shape : read_shapes(*writer)) {
+			Util::add_to_running_statistics(database_statistics.surface_area, shape.surface_area);
+			Util::add_to_running_statistics(database_statistics.compactness, shape.compactness);
+			Util::add_to_running_statistics(database_statistics.volume, shape.volume);
+			Util::add_to_running_statistics(database_statistics.diameter, shape.diameter);
+			Util::add_to_running_statistics(database_statistics.eccentricity, shape.eccentricity);
+		}
+
+		SQLite::Transaction transaction(*writer);
+		update_statistics(database_statistics);
+		transaction.commit();
+	}
+
+	return 0;
+}
+
+int Database::open_read_only(const boost::filesystem::path &database_path) {
+	close();
+
+	std::unique_ptr<SQLite::Database> connection;
+
+	try {
+		connection.reset(new SQLite::Database(database_path.string(), SQLite::OPEN_READONLY,
+		                                      DATABASE_BUSY_TIMEOUT_MS));
+
+		if (!is_up_to_date(*connection))
+			return open(database_path);
+	}
+	catch (std::exception &e) {
+		if (PRINT_DB_ERRORS) {
+			std::cout << "SQLite exception: " << e.what() << std::endl;
+		}
+		return EXIT_FAILURE;
+	}
+
+	this->database_path = database_path;
+
+	// Becomes the first connection of the read pool
+	idle_readers.push_back(std::move(connection));
 	return 0;
 }
 
+bool Database::is_read_only() const {
+	return writer == nullptr;
+}
+
+const boost::filesystem::path &Database::path() const {
+	return database_path;
+}
+
+Database::ReadConnection::ReadConnection(const Database &database) : database(database) {
+	{
+		std::lock_guard<std::mutex> lock(database.idle_readers_mutex);
+
+		if (!database.idle_readers.empty()) {
+			connection = std::move(database.idle_readers.back());
+			database.idle_readers.pop_back();
+			return;
+		}
+	}
+
+	connection.reset(new SQLite::Database(database.database_path.string(), SQLite::OPEN_READONLY,
+	                                      DATABASE_BUSY_TIMEOUT_MS));
+}
+
+Database::ReadConnection::~ReadConnection() {
+	std::lock_guard<std::mutex> lock(database.idle_readers_mutex);
+	database.idle_readers.push_back(std::move(connection));
+}
+
+SQLite::Database &Database::ReadConnection::operator*() const {
+	return *connection;
+}
+
 bool Database::create_metadata_table_if_needed() {
-	if (db.tableExists("metadata")) {
+	if (writer->tableExists("metadata")) {
 		return false;
 	}
 
@@ -96,20 +244,79 @@ bool Database::create_metadata_table_if_needed() {
 	                          "'weight_D2' REAL NOT NULL DEFAULT 0.1,"
 	                          "'weight_D3' REAL NOT NULL DEFAULT 0.1,"
 	                          "'weight_D4' REAL NOT NULL DEFAULT 0.1,"
+	                          "'generation' INTEGER NOT NULL DEFAULT 0,"
+	                          "'ann_eps' REAL NOT NULL DEFAULT 0,"
+	                          "'ann_search_strategy' TEXT NOT NULL DEFAULT '"
+	                          + Util::ToString(DEFAULT_ANN_SEARCH_STRATEGY) +
+	                          "',"
+	                          "'ann_max_points_visited' INTEGER NOT NULL DEFAULT 0,"
+	                          "'ann_tree' TEXT NOT NULL DEFAULT '" + Util::ToString(DEFAULT_ANN_TREE) + "',"
+	                          "'ann_split_rule' TEXT NOT NULL DEFAULT '" + Util::ToString(DEFAULT_ANN_SPLIT_RULE) + "',"
+	                          "'ann_shrink_rule' TEXT NOT NULL DEFAULT '" + Util::ToString(DEFAULT_ANN_SHRINK_RULE) + "',"
+	                          "'hnsw_m' INTEGER NOT NULL DEFAULT " + to_string(DEFAULT_HNSW_M) + ","
+	                          "'hnsw_ef_construction' INTEGER NOT NULL DEFAULT "
+	                          + to_string(DEFAULT_HNSW_EF_CONSTRUCTION) + ","
+	                          "'hnsw_ef_search' INTEGER NOT NULL DEFAULT " + to_string(DEFAULT_HNSW_EF_SEARCH) + ","
+	                          "'candidate_pool_multiplier' INTEGER NOT NULL DEFAULT "
+	                          + to_string(DEFAULT_CANDIDATE_POOL_MULTIPLIER) + ","
+	                          "'scan_thread_count' INTEGER NOT NULL DEFAULT "
+	                          + to_string(DEFAULT_SCAN_THREAD_COUNT) + ","
+	                          "'query_cache_capacity' INTEGER NOT NULL DEFAULT "
+	                          + to_string(DEFAULT_QUERY_CACHE_CAPACITY) + ","
+	                          "'ivf_list_count' INTEGER NOT NULL DEFAULT " + to_string(DEFAULT_IVF_LIST_COUNT) + ","
+	                          "'ivf_probe_count' INTEGER NOT NULL DEFAULT " + to_string(DEFAULT_IVF_PROBE_COUNT) + ","
 	                          "PRIMARY KEY('index' AUTOINCREMENT));";
 
-	SQLite::Transaction transaction(db);
-	db.exec(query);
+	SQLite::Transaction transaction(*writer);
+	writer->exec(query);
+	transaction.commit();
+	return true;
+}
+
+bool Database::has_column(SQLite::Database &connection, const std::string &table, const std::string &column) {
+	SQLite::Statement statement(connection, "PRAGMA table_info('" + table + "');");
+
+	while (statement.executeStep()) {
+		if (column == statement.getColumn(1).getString())
+			return true;
+	}
+
+	return false;
+}
+
+bool Database::is_up_to_date(SQLite::Database &connection) {
+	// Migrations are applied in order, so the last column each of them adds tells whether it ran
+	return connection.tableExists("metadata") && connection.tableExists("shapes")
+	       && connection.tableExists("statistics")
+	       && has_column(connection, "metadata", "ivf_probe_count")
+	       && has_column(connection, "shapes", "d4_sorted")
+	       && !has_column(connection, "shapes", "surface_area_normalized");
+}
+
+bool Database::add_column_if_needed(const std::string &table, const std::string &column,
+                                    const std::string &definition) {
+	if (has_column(*writer, table, column))
+		return false;
+
+	SQLite::Transaction transaction(*writer);
+	writer->exec("ALTER TABLE '" + table + "' ADD COLUMN '" + column + "' " + definition + ";");
 	transaction.commit();
 	return true;
 }
 
 bool Database::create_shapes_table_if_needed() {
-	if (db.tableExists("shapes")) {
+	if (writer->tableExists("shapes")) {
 		return false;
 	}
 
-	const std::string query = "CREATE TABLE 'shapes' ("
+	SQLite::Transaction transaction(*writer);
+	create_shapes_table("shapes");
+	transaction.commit();
+	return true;
+}
+
+void Database::create_shapes_table(const std::string &table) {
+	const std::string query = "CREATE TABLE '" + table + "' ("
 	                          "'index' INTEGER UNIQUE NOT NULL,"
 	                          "'filename' TEXT NOT NULL,"
 	                          "'surface_area' REAL NOT NULL,"
@@ -122,15 +329,47 @@ bool Database::create_shapes_table_if_needed() {
 	                          "'d2' TEXT NOT NULL,"
 	                          "'d3' TEXT NOT NULL,"
 	                          "'d4' TEXT NOT NULL,"
-	                          "'surface_area_normalized' REAL NOT NULL,"
-	                          "'compactness_normalized' REAL NOT NULL,"
-	                          "'volume_normalized' REAL NOT NULL,"
-	                          "'diameter_normalized' REAL NOT NULL,"
-	                          "'eccentricity_normalized' REAL NOT NULL,"
+	                          "'a3_sorted' TEXT NOT NULL DEFAULT '',"
+	                          "'d1_sorted' TEXT NOT NULL DEFAULT '',"
+	                          "'d2_sorted' TEXT NOT NULL DEFAULT '',"
+	                          "'d3_sorted' TEXT NOT NULL DEFAULT '',"
+	                          "'d4_sorted' TEXT NOT NULL DEFAULT '',"
 	                          "PRIMARY KEY('index' AUTOINCREMENT));";
 
-	SQLite::Transaction transaction(db);
-	db.exec(query);
+	writer->exec(query);
+}
+
+bool Database::drop_normalized_columns_if_needed() {
+	if (!has_column(*writer, "shapes", "surface_area_normalized"))
+		return false;
+
+	// SQLite cannot drop columns, so the table is rebuilt and its rows copied over with their ids
+	const std::string columns = "`index`, `filename`, `surface_area`, `compactness`, `volume`, `diameter`,"
+	                            " `eccentricity`, `a3`, `d1`, `d2`, `d3`, `d4`";
+
+	SQLite::Transaction transaction(*writer);
+	writer->exec("ALTER TABLE `shapes` RENAME TO `shapes_normalized`;");
+	create_shapes_table("shapes");
+	writer->exec("INSERT INTO `shapes` (" + columns + ") SELECT " + columns + " FROM `shapes_normalized`;");
+	writer->exec("DROP TABLE `shapes_normalized`;");
+	transaction.commit();
+	return true;
+}
+
+bool Database::create_statistics_table_if_needed() {
+	if (writer->tableExists("statistics")) {
+		return false;
+	}
+
+	const std::string query = "CREATE TABLE 'statistics' ("
+	                          "'descriptor' TEXT UNIQUE NOT NULL,"
+	                          "'count' INTEGER NOT NULL DEFAULT 0,"
+	                          "'mean' REAL NOT NULL DEFAULT 0,"
+	                          "'m2' REAL NOT NULL DEFAULT 0,"
+	                          "PRIMARY KEY('descriptor'));";
+
+	SQLite::Transaction transaction(*writer);
+	writer->exec(query);
 	transaction.commit();
 	return true;
 }
@@ -156,7 +395,22 @@ void Database::update_metadata(const DatabaseMetadata &metadata) {
 	                          "'weight_D1',"
 	                          "'weight_D2',"
 	                          "'weight_D3',"
-	                          "'weight_D4'"
+	                          "'weight_D4',"
+	                          "'generation',"
+	                          "'ann_eps',"
+	                          "'ann_search_strategy',"
+	                          "'ann_max_points_visited',"
+	                          "'ann_tree',"
+	                          "'ann_split_rule',"
+	                          "'ann_shrink_rule',"
+	                          "'hnsw_m',"
+	                          "'hnsw_ef_construction',"
+	                          "'hnsw_ef_search',"
+	                          "'candidate_pool_multiplier',"
+	                          "'scan_thread_count',"
+	                          "'query_cache_capacity',"
+	                          "'ivf_list_count',"
+	                          "'ivf_probe_count'"
 	                          ") VALUES ("
 	                          "(SELECT 'index' FROM 'metadata' WHERE 'index' = 1),"
 	                          + to_string(metadata.backend_version_major) + ","
@@ -177,16 +431,70 @@ void Database::update_metadata(const DatabaseMetadata &metadata) {
 	                          + to_string(metadata.weight_D1) + "','"
 	                          + to_string(metadata.weight_D2) + "','"
 	                          + to_string(metadata.weight_D3) + "','"
-	                          + to_string(metadata.weight_D4) + "');";
-
-	SQLite::Transaction transaction(db);
-	db.exec(query);
+	                          + to_string(metadata.weight_D4) + "','"
+	                          + to_string(metadata.generation) + "','"
+	                          + to_string(metadata.ann_eps) + "','"
+	                          + Util::ToString(metadata.ann_search_strategy) + "','"
+	                          + to_string(metadata.ann_max_points_visited) + "','"
+	                          + Util::ToString(metadata.ann_tree) + "','"
+	                          + Util::ToString(metadata.ann_split_rule) + "','"
+	                          + Util::ToString(metadata.ann_shrink_rule) + "','"
+	                          + to_string(metadata.hnsw_m) + "','"
+	                          + to_string(metadata.hnsw_ef_construction) + "','"
+	                          + to_string(metadata.hnsw_ef_search) + "','"
+	                          + to_string(metadata.candidate_pool_multiplier) + "','"
+	                          + to_string(metadata.scan_thread_count) + "','"
+	                          + to_string(metadata.query_cache_capacity) + "','"
+	                          + to_string(metadata.ivf_list_count) + "','"
+	                          + to_string(metadata.ivf_probe_count) + "');";
+
+	SQLite::Transaction transaction(*writer);
+	writer->exec(query);
 	transaction.commit();
 }
 
 int Database::add_shape(const DatabaseShape &shape) {
-	std::string path = shape.filename;
+	std::lock_guard<std::mutex> lock(writer_mutex);
+	SQLite::Transaction transaction(*writer);
+
+	DatabaseStatistics database_statistics = read_statistics(*writer);
+	insert_shape(shape, database_statistics);
+	update_statistics(database_statistics);
+	increment_generation();
+
+	transaction.commit();
+	return 0;
+}
+
+bool Database::add_shapes(const std::vector<DatabaseShape> &shapes) {
+	std::lock_guard<std::mutex> lock(writer_mutex);
+	SQLite::Transaction transaction(*writer);
 
+	DatabaseStatistics database_statistics = read_statistics(*writer);
+	for (const DatabaseShape &shape : shapes)
+		insert_shape(shape, database_statistics);
+	update_statistics(database_statistics);
+	increment_generation();
+
+	transaction.commit();
+	return true;
+}
+
+void Database::insert_shape(const DatabaseShape &shape, DatabaseStatistics &statistics) {
+	// A replaced row has to be taken out of the running statistics before its new values go in
+	SQLite::Statement existing_statement(*writer, "SELECT `surface_area`, `compactness`, `volume`, `diameter`, `eccentricity`"
+	                                         " FROM `shapes` WHERE `index` = ?;");
+	existing_statement.bind(1, shape.index);
+
+	if (existing_statement.executeStep()) {
+		Util::remove_from_running_statistics(statistics.surface_area, existing_statement.getColumn(0));
+		Util::remove_from_running_statistics(statistics.compactness, existing_statement.getColumn(1));
+		Util::remove_from_running_statistics(statistics.volume, existing_statement.getColumn(2));
+		Util::remove_from_running_statistics(statistics.diameter, existing_statement.getColumn(3));
+		Util::remove_from_running_statistics(statistics.eccentricity, existing_statement.getColumn(4));
+	}
+
+	// Values are bound rather than formatted, so the statistics see exactly what is stored
 	const std::string query = "INSERT OR REPLACE INTO `shapes` ("
 	                          "`index`,"
 	                          "`filename`,"
@@ -200,50 +508,114 @@ int Database::add_shape(const DatabaseShape &shape) {
 	                          "`d2`,"
 	                          "`d3`,"
 	                          "`d4`,"
-	                          "`surface_area_normalized`,"
-	                          "`compactness_normalized`,"
-	                          "`volume_normalized`,"
-	                          "`diameter_normalized`,"
-	                          "`eccentricity_normalized`)"
+	                          "`a3_sorted`,"
+	                          "`d1_sorted`,"
+	                          "`d2_sorted`,"
+	                          "`d3_sorted`,"
+	                          "`d4_sorted`)"
 	                          " VALUES "
-	                          "("
-	                          "(SELECT `index` FROM `shapes` WHERE `index` = " + to_string(shape.index) + "),"
-	                          + "\"" + path + "\","
-	                          + to_string(shape.surface_area) + ","
-	                          + to_string(shape.compactness) + ","
-	                          + to_string(shape.volume) + ","
-	                          + to_string(shape.diameter) + ","
-	                          + to_string(shape.eccentricity) + ","
-	                          + "\"" + Util::serialize(shape.a3) + "\","
-	                          + "\"" + Util::serialize(shape.d1) + "\","
-	                          + "\"" + Util::serialize(shape.d2) + "\","
-	                          + "\"" + Util::serialize(shape.d3) + "\","
-	                          + "\"" + Util::serialize(shape.d4) + "\","
-	                          + to_string(shape.surface_area_normalized) + ","
-	                          + to_string(shape.compactness_normalized) + ","
-	                          + to_string(shape.volume_normalized) + ","
-	                          + to_string(shape.diameter_normalized) + ","
-	                          + to_string(shape.eccentricity_normalized) + ");";
-
-	SQLite::Transaction transaction(db);
-	db.exec(query);
-	transaction.commit();
-	return 0;
+	                          "((SELECT `index` FROM `shapes` WHERE `index` = ?), ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?,"
+	                          " ?, ?, ?, ?, ?);";
+
+	SQLite::Statement statement(*writer, query);
+	statement.bind(1, shape.index);
+	statement.bind(2, shape.filename);
+	statement.bind(3, shape.surface_area);
+	statement.bind(4, shape.compactness);
+	statement.bind(5, shape.volume);
+	statement.bind(6, shape.diameter);
+	statement.bind(7, shape.eccentricity);
+	statement.bind(8, Util::serialize(shape.a3));
+	statement.bind(9, Util::serialize(shape.d1));
+	statement.bind(10, Util::serialize(shape.d2));
+	statement.bind(11, Util::serialize(shape.d3));
+	statement.bind(12, Util::serialize(shape.d4));
+	// Sorted once here rather than at every comparison
+	statement.bind(13, Util::serialize(Util::sorted(shape.a3)));
+	statement.bind(14, Util::serialize(Util::sorted(shape.d1)));
+	statement.bind(15, Util::serialize(Util::sorted(shape.d2)));
+	statement.bind(16, Util::serialize(Util::sorted(shape.d3)));
+	statement.bind(17, Util::serialize(Util::sorted(shape.d4)));
+	statement.exec();
+
+	Util::add_to_running_statistics(statistics.surface_area, shape.surface_area);
+	Util::add_to_running_statistics(statistics.compactness, shape.compactness);
+	Util::add_to_running_statistics(statistics.volume, shape.volume);
+	Util::add_to_running_statistics(statistics.diameter, shape.diameter);
+	Util::add_to_running_statistics(statistics.eccentricity, shape.eccentricity);
 }
 
-bool Database::add_shapes(const std::vector<DatabaseShape> &shapes) {
-	bool result = true;
-	for (const DatabaseShape &shape : shapes) {
-		if (add_shape(shape) != 0) {
-			result = false;
-		}
+void Database::backfill_sorted_histograms() {
+	SQLite::Transaction transaction(*writer);
+	SQLite::Statement statement(*writer, "UPDATE `shapes` SET `a3_sorted` = ?, `d1_sorted` = ?, `d2_sorted` = ?,"
+	                                     " `d3_sorted` = ?, `d4_sorted` = ? WHERE `index` = ?;");
+
+	for (const DatabaseShape &shape : read_shapes(*writer)) {
+		statement.bind(1, Util::serialize(Util::sorted(shape.a3)));
+		statement.bind(2, Util::serialize(Util::sorted(shape.d1)));
+		statement.bind(3, Util::serialize(Util::sorted(shape.d2)));
+		statement.bind(4, Util::serialize(Util::sorted(shape.d3)));
+		statement.bind(5, Util::serialize(Util::sorted(shape.d4)));
+		statement.bind(6, shape.index);
+		statement.exec();
+		statement.reset();
 	}
-	return result;
+
+	transaction.commit();
 }
 
-DatabaseMetadata Database::metadata() {
+void Database::increment_generation() {
+	writer->exec("UPDATE `metadata` SET `generation` = `generation` + 1 WHERE `index` = 1;");
+}
+
+void Database::update_statistics(const DatabaseStatistics &statistics) {
+	update_descriptor_statistics("surface_area", statistics.surface_area);
+	update_descriptor_statistics("compactness", statistics.compactness);
+	update_descriptor_statistics("volume", statistics.volume);
+	update_descriptor_statistics("diameter", statistics.diameter);
+	update_descriptor_statistics("eccentricity", statistics.eccentricity);
+}
+
+void Database::update_descriptor_statistics(const std::string &descriptor, const RunningStatistics &statistics) {
+	SQLite::Statement statement(*writer, "INSERT OR REPLACE INTO `statistics` (`descriptor`, `count`, `mean`, `m2`)"
+	                                " VALUES (?, ?, ?, ?);");
+	statement.bind(1, descriptor);
+	statement.bind(2, statistics.count);
+	statement.bind(3, statistics.mean);
+	statement.bind(4, statistics.m2);
+	statement.exec();
+}
+
+RunningStatistics *Database::descriptor_statistics(DatabaseStatistics &statistics, const std::string &descriptor) {
+	if (descriptor == "surface_area")
+		return &statistics.surface_area;
+	else if (descriptor == "compactness")
+		return &statistics.compactness;
+	else if (descriptor == "volume")
+		return &statistics.volume;
+	else if (descriptor == "diameter")
+		return &statistics.diameter;
+	else if (descriptor == "eccentricity")
+		return &statistics.eccentricity;
+
+	return nullptr;
+}
+
+DatabaseMetadata Database::metadata() const {
+	return read_metadata(*ReadConnection(*this));
+}
+
+vector<DatabaseShape> Database::shapes() const {
+	return read_shapes(*ReadConnection(*this));
+}
+
+DatabaseStatistics Database::statistics() const {
+	return read_statistics(*ReadConnection(*this));
+}
+
+DatabaseMetadata Database::read_metadata(SQLite::Database &connection) {
 	const std::string query = "SELECT * FROM `metadata` WHERE `index` = 1;";
-	SQLite::Statement statement(db, query);
+	SQLite::Statement statement(connection, query);
 
 	DatabaseMetadata metadata = DatabaseMetadata();
 
@@ -278,14 +650,43 @@ DatabaseMetadata Database::metadata() {
 		metadata.weight_D2 = statement.getColumn(17);
 		metadata.weight_D3 = statement.getColumn(18);
 		metadata.weight_D4 = statement.getColumn(19);
+
+		metadata.generation = statement.getColumn(20);
+
+		metadata.ann_eps = statement.getColumn(21);
+		Util::EnumFromString(statement.getColumn(22).getString(), Util::PRIORITY, metadata.ann_search_strategy);
+		metadata.ann_max_points_visited = statement.getColumn(23);
+
+		metadata.ann_tree = DEFAULT_ANN_TREE;
+		metadata.ann_split_rule = DEFAULT_ANN_SPLIT_RULE;
+		metadata.ann_shrink_rule = DEFAULT_ANN_SHRINK_RULE;
+		Util::EnumFromString(statement.getColumn(24).getString(), Util::BD_TREE, metadata.ann_tree);
+		Util::EnumFromString(statement.getColumn(25).getString(), Util::KD_SUGGEST, metadata.ann_split_rule);
+		Util::EnumFromString(statement.getColumn(26).getString(), Util::BD_SUGGEST, metadata.ann_shrink_rule);
+
+		metadata.hnsw_m = statement.getColumn(27);
+		metadata.hnsw_ef_construction = statement.getColumn(28);
+		metadata.hnsw_ef_search = statement.getColumn(29);
+
+		metadata.candidate_pool_multiplier = statement.getColumn(30);
+
+		metadata.scan_thread_count = statement.getColumn(31);
+
+		metadata.query_cache_capacity = statement.getColumn(32);
+
+		metadata.ivf_list_count = statement.getColumn(33);
+		metadata.ivf_probe_count = statement.getColumn(34);
 	}
 
 	return metadata;
 }
 
-vector<DatabaseShape> Database::shapes() {
-	const std::string query = "SELECT * FROM `shapes`;";
-	SQLite::Statement statement(db, query);
+vector<DatabaseShape> Database::read_shapes(SQLite::Database &connection) {
+	// Columns are named, as tables from older releases hold them in another order
+	const std::string query = "SELECT `index`, `filename`, `surface_area`, `compactness`, `volume`, `diameter`,"
+	                          " `eccentricity`, `a3`, `d1`, `d2`, `d3`, `d4`, `a3_sorted`, `d1_sorted`, `d2_sorted`,"
+	                          " `d3_sorted`, `d4_sorted` FROM `shapes`;";
+	SQLite::Statement statement(connection, query);
 
 	vector<DatabaseShape> shapes = {};
 
@@ -308,12 +709,11 @@ vector<DatabaseShape> Database::shapes() {
 		shape.d2 = Util::deserialize(statement.getColumn(9));
 		shape.d3 = Util::deserialize(statement.getColumn(10));
 		shape.d4 = Util::deserialize(statement.getColumn(11));
-
-		shape.surface_area_normalized = statement.getColumn(12);
-		shape.compactness_normalized = statement.getColumn(13);
-		shape.volume_normalized = statement.getColumn(14);
-		shape.diameter_normalized = statement.getColumn(15);
-		shape.eccentricity_normalized = statement.getColumn(16);
+		shape.a3_sorted = Util::deserialize(statement.getColumn(12));
+		shape.d1_sorted = Util::deserialize(statement.getColumn(13));
+		shape.d2_sorted = Util::deserialize(statement.getColumn(14));
+		shape.d3_sorted = Util::deserialize(statement.getColumn(15));
+		shape.d4_sorted = Util::deserialize(statement.getColumn(16));
 
 		shapes.push_back(shape);
 	}
@@ -321,8 +721,28 @@ vector<DatabaseShape> Database::shapes() {
 	return shapes;
 }
 
-DatabaseShape Database::get_shape_from_filename(const std::string &filename) {
-	std::vector<DatabaseShape> shapes = Database::shapes();
+DatabaseStatistics Database::read_statistics(SQLite::Database &connection) {
+	const std::string query = "SELECT `descriptor`, `count`, `mean`, `m2` FROM `statistics`;";
+	SQLite::Statement statement(connection, query);
+
+	DatabaseStatistics statistics = DatabaseStatistics();
+
+	while (statement.executeStep()) {
+		RunningStatistics *running_statistics = descriptor_statistics(statistics, statement.getColumn(0));
+
+		if (running_statistics == nullptr)
+			continue;
+
+		running_statistics->count = statement.getColumn(1);
+		running_statistics->mean = statement.getColumn(2);
+		running_statistics->m2 = statement.getColumn(3);
+	}
+
+	return statistics;
+}
+
+DatabaseShape Database::get_shape_from_filename(const std::string &filename) const {
+	std::vector<DatabaseShape> shapes = this->shapes();
 
 	DatabaseShape databaseShape;
 
@@ -337,6 +757,8 @@ DatabaseShape Database::get_shape_from_filename(const std::string &filename) {
 }
 
 int Database::close() {
-	db = SQLite::Database("");
+	idle_readers.clear();
+	writer.reset();
+	database_path.clear();
 	return 0;
 }
\ No newline at end of file
@@ -3,6 +3,8 @@
 
 #include <boost/filesystem.hpp>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <SQLiteCpp/Database.h>
 #include <SQLiteCpp/Transaction.h>
 #include <vector>
@@ -21,7 +23,7 @@ struct DatabaseMetadata {
 	std::string originals_dir;
 	std::string cache_dir;
 
-	int maximum_returned_matches;
+	int maximum_returned_matches; // RANGE matching returns every match, in pages of this many with --page
 	double maximum_feature_matching_distance;
 
 	double weight_surface_area;
@@ -34,6 +36,39 @@ struct DatabaseMetadata {
 	double weight_D2;
 	double weight_D3;
 	double weight_D4;
+
+	int generation; // Incremented on every change to the shapes table
+
+	// Approximation of KNN and RNN searches; all zero searches exactly
+	double ann_eps; // Matches may be up to (1 + ann_eps) times as far as the true ones
+	Util::AnnSearchStrategy ann_search_strategy;
+	int ann_max_points_visited; // Search stops after this many points; 0 for no limit
+
+	// Structure of the ANN index, which changes its speed and size but not what it finds
+	Util::AnnTree ann_tree;
+	Util::AnnSplitRule ann_split_rule;
+	Util::AnnShrinkRule ann_shrink_rule; // Ignored by kd-trees
+
+	// HNSW graph: links per node and candidate list length while inserting, which set its quality and size,
+	// and candidate list length while searching, which trades recall for speed
+	int hnsw_m;
+	int hnsw_ef_construction;
+	int hnsw_ef_search;
+
+	// Methods that rank candidates approximately first rerank this many times maximum_returned_matches of them exactly
+	int candidate_pool_multiplier;
+
+	// Threads an STD scan is split over; 0 for one per core, or fewer for stores of less than a few thousand shapes per
+	// core
+	int scan_thread_count;
+
+	// Query results --query keeps for shapes queried again; 0 to keep none
+	int query_cache_capacity;
+
+	// IVF index: posting lists it splits the shapes into, which sets its training time (0 for about the square root of
+	// the shape count), and lists a search ranks, which trades recall for speed
+	int ivf_list_count;
+	int ivf_probe_count;
 };
 
 struct DatabaseShape {
@@ -49,6 +84,13 @@ struct DatabaseShape {
 	std::vector<double> d2;
 	std::vector<double> d3;
 	std::vector<double> d4;
+	// The bars of a3 to d4 in ascending order, which is all the EMD between two histograms depends on
+	std::vector<double> a3_sorted;
+	std::vector<double> d1_sorted;
+	std::vector<double> d2_sorted;
+	std::vector<double> d3_sorted;
+	std::vector<double> d4_sorted;
+	// Not stored; derived from DatabaseStatistics at match time
 	double surface_area_normalized;
 	double compactness_normalized;
 	double volume_normalized;
@@ -56,32 +98,115 @@ struct DatabaseShape {
 	double eccentricity_normalized;
 };
 
+struct DatabaseStatistics {
+	RunningStatistics surface_area;
+	RunningStatistics compactness;
+	RunningStatistics volume;
+	RunningStatistics diameter;
+	RunningStatistics eccentricity;
+};
+
+// One database file, safe to share between threads once opened.
+// Reads borrow a connection from a pool and never block each other, or the writer (the file is kept in WAL mode).
+// Writes go through a single connection, one transaction at a time.
+// open() and close() must not run concurrently with anything else.
+// A database opened with open_read_only() has no writer and must not be written to.
 class Database {
 public:
+	Database() = default;
+
+	Database(const Database &) = delete;
+
+	Database &operator=(const Database &) = delete;
+
 	static int create(const boost::filesystem::path &database_path);
 
-	static int open(const boost::filesystem::path &database_path);
+	int open(const boost::filesystem::path &database_path);
+
+	// Opens the database without taking the writer, without switching it to WAL mode and without migrating it, so
+	// that nothing is written. A database whose schema is out of date is opened with open() instead, once.
+	int open_read_only(const boost::filesystem::path &database_path);
+
+	bool is_read_only() const;
 
-	static int add_shape(const DatabaseShape &shape);
+	const boost::filesystem::path &path() const;
 
-	static bool add_shapes(const std::vector<DatabaseShape> &shapes);
+	int add_shape(const DatabaseShape &shape);
 
-	static DatabaseMetadata metadata();
+	bool add_shapes(const std::vector<DatabaseShape> &shapes);
 
-	static vector<DatabaseShape> shapes();
+	DatabaseMetadata metadata() const;
 
-	static DatabaseShape get_shape_from_filename(const std::string &filename);
+	vector<DatabaseShape> shapes() const;
 
-	static int close();
+	DatabaseStatistics statistics() const;
+
+	DatabaseShape get_shape_from_filename(const std::string &filename) const;
+
+	int close();
 
 private:
-	static SQLite::Database db;
+	// Borrows a read connection from the pool for as long as it lives, opening a new one if none is idle
+	class ReadConnection {
+	public:
+		explicit ReadConnection(const Database &database);
+
+		~ReadConnection();
+
+		SQLite::Database &operator*() const;
+
+	private:
+		const Database &database;
+		std::unique_ptr<SQLite::Database> connection;
+	};
+
+	boost::filesystem::path database_path;
+
+	std::unique_ptr<SQLite::Database> writer;
+	std::mutex writer_mutex;
+
+	mutable std::vector<std::unique_ptr<SQLite::Database>> idle_readers;
+	mutable std::mutex idle_readers_mutex;
+
+	static DatabaseMetadata read_metadata(SQLite::Database &connection);
+
+	static vector<DatabaseShape> read_shapes(SQLite::Database &connection);
+
+	static DatabaseStatistics read_statistics(SQLite::Database &connection);
+
+	bool create_metadata_table_if_needed();
+
+	bool create_shapes_table_if_needed();
+
+	void create_shapes_table(const std::string &table);
+
+	// Rebuilds a shapes table from before the running statistics without its *_normalized columns, which inserts
+	// cannot fill. Returns whether it did, in which case the sorted histograms still have to be backfilled.
+	bool drop_normalized_columns_if_needed();
+
+	bool create_statistics_table_if_needed();
+
+	static bool has_column(SQLite::Database &connection, const std::string &table, const std::string &column);
+
+	// Whether open() would not migrate anything
+	static bool is_up_to_date(SQLite::Database &connection);
+
+	bool add_column_if_needed(const std::string &table, const std::string &column, const std::string &definition);
+
+	// Fills the sorted histogram columns of rows stored before those columns existed
+	void backfill_sorted_histograms();
+
+	void increment_generation();
+
+	void update_metadata(const DatabaseMetadata &metadata);
+
+	void insert_shape(const DatabaseShape &shape, DatabaseStatistics &statistics);
 
-	static bool create_metadata_table_if_needed();
+	void update_statistics(const DatabaseStatistics &statistics);
 
-	static bool create_shapes_table_if_needed();
+	void update_descriptor_statistics(const std::string &descriptor, const RunningStatistics &statistics);
 
-	static void update_metadata(const DatabaseMetadata &metadata);
+	static RunningStatistics *descriptor_statistics(DatabaseStatistics &statistics, const std::string &descriptor);
 };
 
 #endif //BACKEND_DATABASE_H
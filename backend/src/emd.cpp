@@ -0,0 +1,70 @@
+#include "emd.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+typedef std::array<double, HISTOGRAM_BAR_COUNT + 1> CumulativeWeights;
+
+// Fraction of a histogram's samples at or below a position, by the number of samples there.
+// Accumulated one weight at a time and divided by the total, in the same order as wasserstein().
+static CumulativeWeights cumulative_weights() {
+	const double weight = 1.0 / HISTOGRAM_BAR_COUNT;
+
+	CumulativeWeights accumulated = {0};
+	for (int i = 1; i <= HISTOGRAM_BAR_COUNT; i++)
+		accumulated[i] = accumulated[i - 1] + weight;
+
+	CumulativeWeights cumulative;
+	for (int i = 0; i <= HISTOGRAM_BAR_COUNT; i++)
+		cumulative[i] = accumulated[i] / accumulated[HISTOGRAM_BAR_COUNT];
+
+	return cumulative;
+}
+
+static const CumulativeWeights CDF = cumulative_weights();
+
+double Emd::histogram_distance(const double *histogram_a, const double *histogram_b) {
+	double sorted_a[HISTOGRAM_BAR_COUNT];
+	double sorted_b[HISTOGRAM_BAR_COUNT];
+
+	sort_histogram(histogram_a, sorted_a);
+	sort_histogram(histogram_b, sorted_b);
+
+	return sorted_histogram_distance(sorted_a, sorted_b);
+}
+
+double Emd::sorted_histogram_distance(const double *sorted_a, const double *sorted_b) {
+	double positions[2 * HISTOGRAM_BAR_COUNT];
+	std::merge(sorted_a, sorted_a + HISTOGRAM_BAR_COUNT, sorted_b, sorted_b + HISTOGRAM_BAR_COUNT, positions);
+
+	// Integrate |CDF_a - CDF_b| between every pair of consecutive sample positions
+	int count_a = 0;
+	int count_b = 0;
+	double distance = 0.0;
+
+	for (int i = 0; i < 2 * HISTOGRAM_BAR_COUNT - 1; i++) {
+		while (count_a < HISTOGRAM_BAR_COUNT && sorted_a[count_a] <= positions[i])
+			count_a++;
+		while (count_b < HISTOGRAM_BAR_COUNT && sorted_b[count_b] <= positions[i])
+			count_b++;
+
+		distance += std::abs(CDF[count_a] - CDF[count_b]) * (positions[i + 1] - positions[i]);
+	}
+
+	return distance;
+}
+
+double Emd::quantile_distance(const double *sorted_a, const double *sorted_b) {
+	double distance = 0.0;
+
+	for (int i = 0; i < HISTOGRAM_BAR_COUNT; i++)
+		distance += std::abs(sorted_a[i] - sorted_b[i]);
+
+	return distance / HISTOGRAM_BAR_COUNT;
+}
+
+void Emd::sort_histogram(const double *histogram, double *sorted) {
+	std::copy(histogram, histogram + HISTOGRAM_BAR_COUNT, sorted);
+	std::sort(sorted, sorted + HISTOGRAM_BAR_COUNT);
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "config.h"
+
+// Earth mover's distance between two histograms of HISTOGRAM_BAR_COUNT bars, as computed by wasserstein() from
+// thirdparty/Wasserstein when every bar has the same weight: the bar values are the positions of equally weighted
+// samples. Works on the stack only, and gives the same result as wasserstein() to the last bit.
+class Emd {
+public:
+	static double histogram_distance(const double *histogram_a, const double *histogram_b);
+
+	// As above, for histograms whose bars are already sorted in ascending order
+	static double sorted_histogram_distance(const double *sorted_a, const double *sorted_b);
+
+	// For two sets of equally many, equally weighted samples the EMD is the mean distance between the i-th smallest
+	// samples of both. A single pass over both histograms; equal to sorted_histogram_distance() up to rounding.
+	static double quantile_distance(const double *sorted_a, const double *sorted_b);
+
+	static void sort_histogram(const double *histogram, double *sorted);
+};
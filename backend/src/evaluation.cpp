@@ -2,63 +2,59 @@
 #include "database_mr.h"
 #include "feature_matching.h"
 
-std::vector<QualityValues> Evaluation::get_quality_values(std::string database_path) {
-	std::map<std::string, QualityValues> mapped_quality_values;
+std::vector<QualityValues> Evaluation::get_quality_values(const Database &database, const DatabaseMetadata &metadata) {
+	FeatureStore store = FeatureStore::load(database, false);
 
-	Database::open(database_path);
-	std::vector<DatabaseShape> shapes = Database::shapes();
+	store.build_index_if_needed(metadata, metadata.feature_matching_method);
 
-	int counter = 0;
+	// The class of every shape is looked up once, so results are compared by class index. Indices are handed out in
+	// order of appearance; the map is ordered by name, the order the classes are reported in.
+	std::map<std::string, int> class_indices;
+	std::vector<int> shape_classes(store.size());
 
-	for (const DatabaseShape &shape : shapes) {
-		std::cout << "Querying " << shape.filename << std::endl;
+	for (int shape_id = 0; shape_id < store.size(); shape_id++)
+		shape_classes[shape_id] = class_indices.emplace(get_class_name(store.filename(shape_id)),
+		                                                (int) class_indices.size()).first->second;
 
-		std::string class_name = get_class_name(shape.filename);
+	std::vector<QualityValues> class_quality_values(class_indices.size());
 
-		if (!mapped_quality_values.count(class_name)) {
-			QualityValues quality_values_instance;
-			quality_values_instance.class_name = class_name;
-			quality_values_instance.shape_count = 0;
-			quality_values_instance.average_true_positives = 0.0;
-			quality_values_instance.average_false_positives = 0.0;
-			quality_values_instance.average_false_negatives = 0.0;
-			quality_values_instance.average_true_positive_rate = 0.0;
-			quality_values_instance.average_false_negative_rate = 0.0;
-			quality_values_instance.average_critical_success_rate = 0.0;
+	for (const auto &class_index : class_indices)
+		class_quality_values[class_index.second].class_name = class_index.first;
 
-			mapped_quality_values.emplace(class_name, quality_values_instance);
-		}
+	int counter = 0;
 
-		QualityValues new_quality_values = mapped_quality_values[class_name];
-		new_quality_values.shape_count++;
+	for (int shape_id = 0; shape_id < store.size(); shape_id++) {
+		std::cout << "Querying " << store.filename(shape_id) << std::endl;
 
-		std::vector<DatabaseShape> similar_shapes = FeatureMatching::get_similar_shapes(shape, shapes, Database::metadata().feature_matching_method);
+		const int shape_class = shape_classes[shape_id];
+		QualityValues &quality_values = class_quality_values[shape_class];
+		quality_values.shape_count++;
+
+		std::vector<ShapeMatch> similar_shapes = FeatureMatching::get_similar_shapes(store.feature_vector(shape_id),
+		                                                                             shape_id, store, metadata,
+		                                                                             metadata.feature_matching_method);
 
 		int true_positives = 0;
 		int false_positives = 0;
 
-		for (auto &similar_shape : similar_shapes) {
-			std::string similar_shape_class_name = get_class_name(similar_shape.filename);
-
-			if (class_name == similar_shape_class_name)
+		for (const ShapeMatch &similar_shape : similar_shapes) {
+			if (shape_classes[similar_shape.shape_id] == shape_class)
 				true_positives++;
 			else
 				false_positives++;
 		}
 
-		new_quality_values.average_true_positives += true_positives;
-		new_quality_values.average_false_positives += false_positives;
-
-		mapped_quality_values[class_name] = new_quality_values;
+		quality_values.average_true_positives += true_positives;
+		quality_values.average_false_positives += false_positives;
 
 		counter++;
-		std::cout << counter << "/" << shapes.size() << std::endl;
+		std::cout << counter << "/" << store.size() << std::endl;
 	}
 
 	std::vector<QualityValues> returned_quality_values;
 
-	for (const auto &x : mapped_quality_values) {
-		QualityValues quality_values = x.second;
+	for (const auto &class_index : class_indices) {
+		QualityValues quality_values = class_quality_values[class_index.second];
 
 		quality_values.average_false_negatives =
 				(quality_values.shape_count * quality_values.shape_count - quality_values.average_true_positives) /
@@ -107,11 +103,43 @@ std::vector<QualityValues> Evaluation::get_quality_values(std::string database_p
 
 	returned_quality_values.push_back(database_quality_values);
 
-	Database::close();
-
 	return returned_quality_values;
 }
 
+double Evaluation::get_recall(const Database &database, const DatabaseMetadata &metadata,
+                              Util::FeatureMatchingMethod method) {
+	FeatureStore store = FeatureStore::load(database, false);
+	store.build_index_if_needed(metadata, method);
+
+	double total_recall = 0;
+	int query_count = 0;
+
+	for (int shape_id = 0; shape_id < store.size(); shape_id++) {
+		const FeatureVector query = store.feature_vector(shape_id);
+
+		std::vector<ShapeMatch> exact_matches = FeatureMatching::get_similar_shapes(
+				query, shape_id, store, metadata, Util::FeatureMatchingMethod::STD);
+
+		if (exact_matches.empty())
+			continue;
+
+		std::vector<ShapeMatch> matches = FeatureMatching::get_similar_shapes(query, shape_id, store, metadata, method);
+		int found = 0;
+
+		for (const ShapeMatch &exact_match : exact_matches)
+			for (const ShapeMatch &match : matches)
+				if (match.shape_id == exact_match.shape_id) {
+					found++;
+					break;
+				}
+
+		total_recall += (double) found / exact_matches.size();
+		query_count++;
+	}
+
+	return query_count == 0 ? 1.0 : total_recall / query_count;
+}
+
 std::string Evaluation::get_class_name(std::string file_name) {
 	int shape_index = std::stoi(file_name.erase(file_name.find_first_of('.'), 4));
 
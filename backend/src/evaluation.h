@@ -2,6 +2,7 @@
 
 #include <vector>
 #include <string>
+#include "database_mr.h"
 
 struct QualityValues {
 	std::string class_name; // This can be a class name or 'Database'
@@ -18,7 +19,11 @@ struct QualityValues {
 
 class Evaluation {
 public:
-	static std::vector<QualityValues> get_quality_values(std::string database_path);
+	static std::vector<QualityValues> get_quality_values(const Database &database, const DatabaseMetadata &metadata);
+
+	// Average fraction of the STD matches of every shape that the given method also returns
+	static double get_recall(const Database &database, const DatabaseMetadata &metadata,
+	                         Util::FeatureMatchingMethod method);
 
 private:
 	static std::string get_class_name(std::string file_name);
@@ -4,43 +4,15 @@
 #include "config.h"
 #include "database_mr.h"
 
-DatabaseShape FeatureExtraction::get_normalized_shape_features(const DatabaseShape &shape, bool print) {
-	DatabaseShape normalized_shape;
+DatabaseShape FeatureExtraction::get_normalized_shape_features(const DatabaseShape &shape,
+                                                               const DatabaseStatistics &statistics, bool print) {
+	DatabaseShape normalized_shape = shape;
 
-	normalized_shape.index = shape.index;
-	normalized_shape.filename = shape.filename;
-
-	normalized_shape.a3 = shape.a3;
-	normalized_shape.d1 = shape.d1;
-	normalized_shape.d2 = shape.d2;
-	normalized_shape.d3 = shape.d3;
-	normalized_shape.d4 = shape.d4;
-
-	normalized_shape.surface_area = shape.surface_area;
-	normalized_shape.compactness = shape.compactness;
-	normalized_shape.volume = shape.volume;
-	normalized_shape.diameter = shape.diameter;
-	normalized_shape.eccentricity = shape.eccentricity;
-
-	std::vector<DatabaseShape> database_shapes = Database::shapes();
-
-	normalized_shape.surface_area_normalized = (shape.surface_area - get_average(SURFACE_AREA, database_shapes)) /
-	                                           get_standard_deviation(SURFACE_AREA, database_shapes);
-	normalized_shape.compactness_normalized = (shape.compactness - get_average(COMPACTNESS, database_shapes)) /
-	                                          get_standard_deviation(COMPACTNESS, database_shapes);
-	normalized_shape.volume_normalized = (shape.volume - get_average(VOLUME, database_shapes)) /
-	                                     get_standard_deviation(VOLUME, database_shapes);
-
-	double diameter_minus_average = shape.diameter - get_average(DIAMETER, database_shapes);
-
-	if (diameter_minus_average == 0.0)
-		normalized_shape.diameter_normalized = 0.0;
-	else
-		normalized_shape.diameter_normalized = (shape.diameter - get_average(DIAMETER, database_shapes)) /
-		                                       get_standard_deviation(DIAMETER, database_shapes);
-
-	normalized_shape.eccentricity_normalized = (shape.eccentricity - get_average(ECCENTRICITY, database_shapes)) /
-	                                           get_standard_deviation(ECCENTRICITY, database_shapes);
+	normalized_shape.surface_area_normalized = get_z_score(shape.surface_area, statistics.surface_area);
+	normalized_shape.compactness_normalized = get_z_score(shape.compactness, statistics.compactness);
+	normalized_shape.volume_normalized = get_z_score(shape.volume, statistics.volume);
+	normalized_shape.diameter_normalized = get_z_score(shape.diameter, statistics.diameter);
+	normalized_shape.eccentricity_normalized = get_z_score(shape.eccentricity, statistics.eccentricity);
 
 	if (print)
 		std::cout << "Finished normalizing features for:\n" << shape.filename << std::endl;
@@ -49,6 +21,10 @@ DatabaseShape FeatureExtraction::get_normalized_shape_features(const DatabaseSha
 }
 
 DatabaseShape FeatureExtraction::get_shape_features(SurfaceMesh &mesh, bool print) {
+	return get_shape_features(mesh, ITEMS_IN_HISTOGRAM_COUNT, print);
+}
+
+DatabaseShape FeatureExtraction::get_shape_features(SurfaceMesh &mesh, int property_item_count, bool print) {
 	DatabaseShape shape;
 
 	if (INCLUDE_FEATURE_SURFACE_AREA)
@@ -64,7 +40,7 @@ DatabaseShape FeatureExtraction::get_shape_features(SurfaceMesh &mesh, bool prin
 
 	if (INCLUDE_FEATURE_A3) {
 		std::vector<PropertyHistogramBar> a3_histogram = get_property_descriptor_histogram(A3, HISTOGRAM_BAR_COUNT,
-		                                                                                   ITEMS_IN_HISTOGRAM_COUNT,
+		                                                                                   property_item_count,
 		                                                                                   mesh, print);
 		std::vector<double> a3_histogram_values;
 		a3_histogram_values.reserve(a3_histogram.size());
@@ -75,7 +51,7 @@ DatabaseShape FeatureExtraction::get_shape_features(SurfaceMesh &mesh, bool prin
 
 	if (INCLUDE_FEATURE_D1) {
 		std::vector<PropertyHistogramBar> d1_histogram = get_property_descriptor_histogram(D1, HISTOGRAM_BAR_COUNT,
-		                                                                                   ITEMS_IN_HISTOGRAM_COUNT,
+		                                                                                   property_item_count,
 		                                                                                   mesh, print);
 		std::vector<double> d1_histogram_values;
 		d1_histogram_values.reserve(d1_histogram.size());
@@ -86,7 +62,7 @@ DatabaseShape FeatureExtraction::get_shape_features(SurfaceMesh &mesh, bool prin
 
 	if (INCLUDE_FEATURE_D2) {
 		std::vector<PropertyHistogramBar> d2_histogram = get_property_descriptor_histogram(D2, HISTOGRAM_BAR_COUNT,
-		                                                                                   ITEMS_IN_HISTOGRAM_COUNT,
+		                                                                                   property_item_count,
 		                                                                                   mesh, print);
 		std::vector<double> d2_histogram_values;
 		d2_histogram_values.reserve(d2_histogram.size());
@@ -97,7 +73,7 @@ DatabaseShape FeatureExtraction::get_shape_features(SurfaceMesh &mesh, bool prin
 
 	if (INCLUDE_FEATURE_D3) {
 		std::vector<PropertyHistogramBar> d3_histogram = get_property_descriptor_histogram(D3, HISTOGRAM_BAR_COUNT,
-		                                                                                   ITEMS_IN_HISTOGRAM_COUNT,
+		                                                                                   property_item_count,
 		                                                                                   mesh, print);
 		std::vector<double> d3_histogram_values;
 		d3_histogram_values.reserve(d3_histogram.size());
@@ -108,7 +84,7 @@ DatabaseShape FeatureExtraction::get_shape_features(SurfaceMesh &mesh, bool prin
 
 	if (INCLUDE_FEATURE_D4) {
 		std::vector<PropertyHistogramBar> d4_histogram = get_property_descriptor_histogram(D4, HISTOGRAM_BAR_COUNT,
-		                                                                                   ITEMS_IN_HISTOGRAM_COUNT,
+		                                                                                   property_item_count,
 		                                                                                   mesh, print);
 		std::vector<double> d4_histogram_values;
 		d4_histogram_values.reserve(d4_histogram.size());
@@ -264,62 +240,12 @@ FeatureExtraction::get_property_descriptor_items_in_range(const std::vector<doub
 	return items_in_range;
 }
 
-double FeatureExtraction::get_average(GlobalDescriptor global_descriptor, const std::vector<DatabaseShape> &shapes) {
-	std::vector<double> numbers;
+double FeatureExtraction::get_z_score(double value, const RunningStatistics &statistics) {
+	double value_minus_average = value - statistics.mean;
+	double standard_deviation = Util::running_standard_deviation(statistics);
 
-	switch (global_descriptor) {
-		case SURFACE_AREA:
-			for (const DatabaseShape &shape : shapes)
-				numbers.push_back(shape.surface_area);
-			return Util::average(numbers);
-		case COMPACTNESS:
-			for (const DatabaseShape &shape : shapes)
-				numbers.push_back(shape.compactness);
-			return Util::average(numbers);
-		case VOLUME:
-			for (const DatabaseShape &shape : shapes)
-				numbers.push_back(shape.volume);
-			return Util::average(numbers);
-		case DIAMETER:
-			for (const DatabaseShape &shape : shapes)
-				numbers.push_back(shape.diameter);
-			return Util::average(numbers);
-		case ECCENTRICITY:
-			for (const DatabaseShape &shape : shapes)
-				numbers.push_back(shape.eccentricity);
-			return Util::average(numbers);
-	}
-
-	return 0.0;
-}
-
-double
-FeatureExtraction::get_standard_deviation(GlobalDescriptor global_descriptor,
-                                          const std::vector<DatabaseShape> &shapes) {
-	std::vector<double> numbers;
-
-	switch (global_descriptor) {
-		case SURFACE_AREA:
-			for (const DatabaseShape &shape : shapes)
-				numbers.push_back(shape.surface_area);
-			return Util::standard_deviation(numbers);
-		case COMPACTNESS:
-			for (const DatabaseShape &shape : shapes)
-				numbers.push_back(shape.compactness);
-			return Util::standard_deviation(numbers);
-		case VOLUME:
-			for (const DatabaseShape &shape : shapes)
-				numbers.push_back(shape.volume);
-			return Util::standard_deviation(numbers);
-		case DIAMETER:
-			for (const DatabaseShape &shape : shapes)
-				numbers.push_back(shape.diameter);
-			return Util::standard_deviation(numbers);
-		case ECCENTRICITY:
-			for (const DatabaseShape &shape : shapes)
-				numbers.push_back(shape.eccentricity);
-			return Util::standard_deviation(numbers);
-	}
+	if (value_minus_average == 0.0 || standard_deviation == 0.0)
+		return 0.0;
 
-	return 0.0;
+	return value_minus_average / standard_deviation;
 }
@@ -39,10 +39,13 @@ struct PropertyHistogramBar
 class FeatureExtraction
 {
 public:
-	// This method needs to be run on each mesh in the database every time a new mesh (or several meshes) is added to the database
-	static DatabaseShape get_normalized_shape_features(const DatabaseShape& shape, bool print);
+	// This method is run at match time; the statistics are kept up to date by the database on every insert
+	static DatabaseShape get_normalized_shape_features(const DatabaseShape& shape, const DatabaseStatistics& statistics, bool print);
 	// This method needs to be run when adding a new mesh to the database - the data retrieved here is the data that goes into the database
 	static DatabaseShape get_shape_features(SurfaceMesh &mesh, bool print);
+	// As above, with histograms of property_item_count random samples each instead of ITEMS_IN_HISTOGRAM_COUNT: faster,
+	// but noisier. Only for queries, as the shapes in the database are compared with the full count.
+	static DatabaseShape get_shape_features(SurfaceMesh &mesh, int property_item_count, bool print);
 
 private:
 	static double get_global_descriptor(GlobalDescriptor global_descriptor, SurfaceMesh &mesh, bool print);
@@ -51,6 +54,5 @@ private:
 	static std::vector<double> get_property_descriptor(PropertyDescriptor property_descriptor, int amount, SurfaceMesh &mesh, bool print);
 	static Eigen::Vector2d get_lowest_and_highest_number_from_list(const std::vector<double>& number_list);
 	static std::vector<double> get_property_descriptor_items_in_range(const std::vector<double>& item_list, float range_min, float range_max, bool is_last_bar);
-	static double get_average(GlobalDescriptor global_descriptor, const std::vector<DatabaseShape>& shapes);
-	static double get_standard_deviation(GlobalDescriptor global_descriptor, const std::vector<DatabaseShape>& shapes);
+	static double get_z_score(double value, const RunningStatistics& statistics);
 };
@@ -1,260 +1,494 @@
 #include "feature_matching.h"
 
+#include <algorithm>
+#include <cmath>
+#include <thread>
 #include <utility>
-#include "../thirdparty/Wasserstein/wasserstein.h"
+#include "ann_index.h"
 #include "config.h"
+#include "emd.h"
+#include "hnsw_index.h"
+#include "ivf_index.h"
+#include "pq_index.h"
 
-std::vector<DatabaseShape>
-FeatureMatching::get_similar_shapes(const DatabaseShape &input_shape,
-                                    const std::vector<DatabaseShape> &database_shapes,
+static const int STANDARD_SCAN_BLOCK_SIZE = 256;
+static const double EARLY_ABANDON_TOLERANCE = 1e-9; // Relative rounding difference allowed between distance sums
+
+static const int QUANTIZED_DISTANCE_LANES = 16;
+static const double QUANTIZED_DISTANCE_TOLERANCE = 1e-4; // Relative error allowed for summing code distances in floats
+
+// STD scans left to use one thread per core use fewer for stores smaller than this many shapes per thread, as starting
+// one costs more
+static const int MINIMUM_SCAN_THREAD_SHAPE_COUNT = 4096;
+
+// Number of candidates approximate methods rerank; one more than the pool, since the query itself may be among them
+static int candidate_pool_size(const DatabaseMetadata &metadata) {
+	return std::max(1, metadata.candidate_pool_multiplier) * metadata.maximum_returned_matches + 1;
+}
+
+// Threads an STD scan of shape_count shapes is split over: scan_thread_count if set, so it can be measured on any store
+static int scan_thread_count(const DatabaseMetadata &metadata, int shape_count) {
+	if (metadata.scan_thread_count > 0)
+		return std::max(1, std::min(metadata.scan_thread_count, shape_count));
+
+	return std::max(1, std::min((int) std::thread::hardware_concurrency(),
+	                            shape_count / MINIMUM_SCAN_THREAD_SHAPE_COUNT));
+}
+
+std::vector<ShapeMatch>
+FeatureMatching::get_similar_shapes(const FeatureVector &query, int query_shape_id,
+                                    const FeatureStore &store, const DatabaseMetadata &metadata,
                                     Util::FeatureMatchingMethod search_type) {
-	std::vector<DatabaseShape> similar_shapes;
+	std::vector<ShapeMatch> similar_shapes = search(query, query_shape_id, store, metadata, search_type);
+
+	if (!similar_shapes.empty()) {
+		if (similar_shapes[0].shape_id == query_shape_id)
+			similar_shapes.erase(similar_shapes.begin(), similar_shapes.begin() + 1);
+	}
+
+	return similar_shapes;
+}
+
+std::vector<ShardMatch>
+FeatureMatching::get_similar_shapes_federated(const FeatureVector &query, int query_shard, int query_shape_id,
+                                              const std::vector<FeatureStore> &stores,
+                                              const DatabaseMetadata &metadata,
+                                              Util::FeatureMatchingMethod search_type) {
+	std::vector<std::vector<ShapeMatch>> shard_matches(stores.size());
+	std::vector<std::thread> threads;
+
+	for (int shard = 0; shard < stores.size(); shard++) {
+		threads.emplace_back([&, shard]() {
+			shard_matches[shard] = search(query, shard == query_shard ? query_shape_id : -1, stores[shard], metadata,
+			                              search_type);
+		});
+	}
+
+	for (std::thread &thread : threads)
+		thread.join();
+
+	std::vector<ShardMatch> similar_shapes;
+
+	for (int shard = 0; shard < stores.size(); shard++) {
+		for (const ShapeMatch &match : shard_matches[shard])
+			similar_shapes.push_back({shard, match.shape_id, match.distance});
+	}
+
+	// Ties are broken on shard and shape id, so the merged order does not depend on thread timing
+	std::sort(similar_shapes.begin(), similar_shapes.end(), [](const ShardMatch &a, const ShardMatch &b) {
+		if (a.distance != b.distance)
+			return a.distance < b.distance;
+		if (a.shard != b.shard)
+			return a.shard < b.shard;
+		return a.shape_id < b.shape_id;
+	});
+
+	// A range search returns every match within the threshold, from every shard
+	if (search_type != Util::FeatureMatchingMethod::RANGE && similar_shapes.size() > metadata.maximum_returned_matches)
+		similar_shapes.resize(metadata.maximum_returned_matches);
+
+	// The query itself is dropped after the merge, the same way a single database drops it
+	if (!similar_shapes.empty()) {
+		const ShardMatch &first = similar_shapes[0];
+
+		if (first.shard == query_shard && first.shape_id == query_shape_id)
+			similar_shapes.erase(similar_shapes.begin(), similar_shapes.begin() + 1);
+	}
 
+	return similar_shapes;
+}
+
+std::vector<ShapeMatch>
+FeatureMatching::search(const FeatureVector &query, int query_shape_id, const FeatureStore &store,
+                        const DatabaseMetadata &metadata, Util::FeatureMatchingMethod search_type) {
 	switch (search_type) {
 		case Util::FeatureMatchingMethod::STD:
-			similar_shapes = get_similar_shapes_standard(input_shape, database_shapes);
-			break;
+			return get_similar_shapes_standard(query, query_shape_id, store, metadata);
 		case Util::FeatureMatchingMethod::KNN:
 		case Util::FeatureMatchingMethod::RNN:
-			similar_shapes = get_similar_shapes_ann(input_shape, database_shapes, search_type);
-			break;
+		case Util::FeatureMatchingMethod::RANGE:
+			return get_similar_shapes_ann(query, query_shape_id, store, metadata, search_type);
+		case Util::FeatureMatchingMethod::HNSW:
+			return get_similar_shapes_hnsw(query, query_shape_id, store, metadata);
+		case Util::FeatureMatchingMethod::SQ8:
+			return get_similar_shapes_quantized(query, query_shape_id, store, metadata);
+		case Util::FeatureMatchingMethod::PQ:
+			return get_similar_shapes_pq(query, query_shape_id, store, metadata);
+		case Util::FeatureMatchingMethod::GLOBAL:
+			return get_similar_shapes_global(query, query_shape_id, store, metadata);
+		case Util::FeatureMatchingMethod::IVF:
+			return get_similar_shapes_ivf(query, query_shape_id, store, metadata);
 	}
 
-	if (!similar_shapes.empty()) {
-		if (similar_shapes[0].filename == input_shape.filename)
-			similar_shapes.erase(similar_shapes.begin(), similar_shapes.begin() + 1);
+	return {};
+}
+
+std::vector<ShapeMatch>
+FeatureMatching::get_similar_shapes_standard(const FeatureVector &query, int query_shape_id,
+                                             const FeatureStore &store, const DatabaseMetadata &metadata) {
+	const FeatureVector sorted_query = FeatureStore::sorted_feature_vector(query);
+	const int thread_count = scan_thread_count(metadata, store.size());
+
+	if (thread_count == 1) {
+		TopK similar_shapes(metadata.maximum_returned_matches);
+		scan_standard(sorted_query, query_shape_id, store, metadata, nullptr, 0, store.size(), similar_shapes);
+		return similar_shapes.take_sorted();
 	}
 
-	return similar_shapes;
+	// Every thread keeps the top k of its own consecutive range of shapes. As TopK orders ties by shape id, the top k
+	// of their union is the top k of a single scan, whatever the thread count.
+	std::vector<TopK> thread_similar_shapes(thread_count, TopK(metadata.maximum_returned_matches));
+	std::vector<std::thread> threads;
+
+	for (int thread = 0; thread < thread_count; thread++) {
+		threads.emplace_back([&, thread]() {
+			scan_standard(sorted_query, query_shape_id, store, metadata, nullptr,
+			              (int) ((long long) thread * store.size() / thread_count),
+			              (int) ((long long) (thread + 1) * store.size() / thread_count),
+			              thread_similar_shapes[thread]);
+		});
+	}
+
+	for (std::thread &thread : threads)
+		thread.join();
+
+	TopK similar_shapes(metadata.maximum_returned_matches);
+
+	for (TopK &thread_matches : thread_similar_shapes)
+		for (const ShapeMatch &match : thread_matches.take_sorted())
+			similar_shapes.push(match.shape_id, match.distance);
+
+	return similar_shapes.take_sorted();
 }
 
-std::vector<DatabaseShape>
-FeatureMatching::get_similar_shapes_standard(DatabaseShape input_shape,
-                                             const std::vector<DatabaseShape> &database_shapes) {
-	const DatabaseMetadata db_metadata = Database::metadata();
+void FeatureMatching::scan_standard(const FeatureVector &sorted_query, int query_shape_id,
+                                    const FeatureStore &store, const DatabaseMetadata &metadata, const int *shape_ids,
+                                    int begin, int end, TopK &similar_shapes) {
+	const DimensionScales scales = dimension_scales(metadata);
+
+	// Partial sums only bound the distance from below while no weight is negative
+	const bool can_abandon = std::all_of(scales.begin(), scales.end(), [](double scale) { return scale >= 0; });
+	const double maximum_distance = metadata.maximum_feature_matching_distance;
+
+	double partial_distances[STANDARD_SCAN_BLOCK_SIZE];
+	int survivors[STANDARD_SCAN_BLOCK_SIZE];
+
+	// Shapes are scanned a block at a time, one descriptor column after the other. A shape is abandoned as soon as its
+	// weighted distance so far exceeds the threshold or the k-th best distance; the distances of the rest are computed
+	// in full by get_feature_distance(), so the results are those of comparing every shape exactly.
+	for (int block_start = begin; block_start < end; block_start += STANDARD_SCAN_BLOCK_SIZE) {
+		const int block_size = std::min(STANDARD_SCAN_BLOCK_SIZE, end - block_start);
+
+		double bound = INFINITY; // Of the squared distance, with room for the partial sums rounding differently
+		if (can_abandon) {
+			bound = maximum_distance * maximum_distance;
+			if (similar_shapes.size() == metadata.maximum_returned_matches && similar_shapes.size() > 0)
+				bound = std::min(bound, similar_shapes.furthest_distance() * similar_shapes.furthest_distance());
+			bound *= 1 + EARLY_ABANDON_TOLERANCE;
+		}
 
-	std::vector<DatabaseShape> similar_shapes;
-	std::vector<double> sorted_distance_list;
-	std::map<double, DatabaseShape> shape_distance_map;
+		std::fill_n(partial_distances, block_size, 0.0);
 
-	for (auto shape_to_check_towards : database_shapes) {
-		if (Util::filename_of_abs_path(input_shape.filename) ==
-		    Util::filename_of_abs_path(shape_to_check_towards.filename))
-			continue;
+		for (int i = 0; i < GLOBAL_DESCRIPTOR_COUNT; i++) {
+			const double *column = store.global_descriptor((GlobalDescriptor) i);
+			const double query_value = sorted_query.values[i];
+			const double scale = scales[i];
 
-		double distance = std::sqrt(FeatureMatching::get_feature_distance(input_shape, shape_to_check_towards));
+			if (shape_ids == nullptr) {
+				for (int j = 0; j < block_size; j++)
+					partial_distances[j] += scale * std::abs(query_value - column[block_start + j]);
+			} else {
+				for (int j = 0; j < block_size; j++)
+					partial_distances[j] += scale * std::abs(query_value - column[shape_ids[block_start + j]]);
+			}
+		}
 
-		bool is_similar = distance < db_metadata.maximum_feature_matching_distance;
+		int survivor_count = 0;
 
-		if (is_similar) {
-			similar_shapes.push_back(shape_to_check_towards);
-			sorted_distance_list.push_back(distance);
-			shape_distance_map.emplace(distance, shape_to_check_towards);
+		for (int j = 0; j < block_size; j++) {
+			if (partial_distances[j] <= bound)
+				survivors[survivor_count++] = j;
+		}
+
+		for (int i = 0; i < PROPERTY_DESCRIPTOR_COUNT && survivor_count > 0; i++) {
+			const int offset = GLOBAL_DESCRIPTOR_COUNT + i * HISTOGRAM_BAR_COUNT;
+			const double *query_histogram = sorted_query.values + offset;
+			const double scale = scales[offset];
+			int kept_count = 0;
+
+			for (int survivor = 0; survivor < survivor_count; survivor++) {
+				const int j = survivors[survivor];
+				const int shape_id = shape_ids == nullptr ? block_start + j : shape_ids[block_start + j];
+				const double *histogram = store.sorted_histogram((PropertyDescriptor) i, shape_id);
+				double histogram_distance = 0;
+
+				for (int bar = 0; bar < HISTOGRAM_BAR_COUNT; bar++)
+					histogram_distance += std::abs(query_histogram[bar] - histogram[bar]);
+
+				partial_distances[j] += scale * histogram_distance;
+
+				if (partial_distances[j] <= bound)
+					survivors[kept_count++] = j;
+			}
+
+			survivor_count = kept_count;
+		}
+
+		for (int survivor = 0; survivor < survivor_count; survivor++) {
+			const int j = survivors[survivor];
+			const int shape_id = shape_ids == nullptr ? block_start + j : shape_ids[block_start + j];
+			double distance = std::sqrt(FeatureMatching::get_feature_distance(sorted_query, store, shape_id, metadata));
+
+			if (distance < maximum_distance && similar_shapes.accepts(distance) && shape_id != query_shape_id)
+				similar_shapes.push(shape_id, distance);
 		}
 	}
 
-	// Sort them in order from low to high
-	std::sort(sorted_distance_list.begin(), sorted_distance_list.end());
+}
+
+std::vector<ShapeMatch>
+FeatureMatching::get_similar_shapes_quantized(const FeatureVector &query, int query_shape_id,
+                                              const FeatureStore &store, const DatabaseMetadata &metadata) {
+	const FeatureVector sorted_query = FeatureStore::sorted_feature_vector(query);
+	const DimensionScales scales = dimension_scales(metadata);
+	const FeatureQuantization &quantization = store.quantization();
+
+	// The distance to a row of codes is the sum of |offsets[i] - steps[i] * code[i]|, which is the weighted distance
+	// to the values the codes decode to. Padding dimensions have zero offset and step.
+	alignas(FEATURE_STORE_ALIGNMENT) float offsets[FEATURE_CODE_STRIDE] = {};
+	alignas(FEATURE_STORE_ALIGNMENT) float steps[FEATURE_CODE_STRIDE] = {};
+	double maximum_error = 0; // Decoded values are at most half a step from the true ones
+
+	for (int i = 0; i < FEATURE_VECTOR_DIMENSION; i++) {
+		offsets[i] = (float) (scales[i] * (sorted_query.values[i] - quantization.minimum[i]));
+		steps[i] = (float) (scales[i] * quantization.step[i]);
+		maximum_error += scales[i] * quantization.step[i] / 2;
+	}
+
+	// A shape whose code distance exceeds this is too far by the exact distance too, whatever its codes round away
+	const double maximum_code_distance = (metadata.maximum_feature_matching_distance
+	                                      * metadata.maximum_feature_matching_distance + maximum_error)
+	                                     * (1 + QUANTIZED_DISTANCE_TOLERANCE);
+
+	TopK candidates(candidate_pool_size(metadata));
+
+	const uint8_t *codes = store.feature_codes(0);
+	const int shape_count = store.size();
+
+	for (int shape_id = 0; shape_id < shape_count; shape_id++, codes += FEATURE_CODE_STRIDE) {
+		// Summed in independent lanes, so the loop vectorizes without reordering floating point additions
+		float lanes[QUANTIZED_DISTANCE_LANES] = {};
+
+		for (int i = 0; i < FEATURE_CODE_STRIDE; i += QUANTIZED_DISTANCE_LANES)
+			for (int lane = 0; lane < QUANTIZED_DISTANCE_LANES; lane++)
+				lanes[lane] += std::abs(offsets[i + lane] - steps[i + lane] * codes[i + lane]);
 
-	std::vector<DatabaseShape> sorted_shape_list;
+		float distance = 0;
 
-	sorted_shape_list.reserve(sorted_distance_list.size());
-	for (double distance : sorted_distance_list) {
-		sorted_shape_list.push_back(shape_distance_map[distance]);
+		for (float lane : lanes)
+			distance += lane;
+
+		if (distance < maximum_code_distance && candidates.accepts(distance))
+			candidates.push(shape_id, distance);
 	}
 
-	std::vector<DatabaseShape> returned_sorted_distance_list;
-	int maximum_returned_matches =
-			db_metadata.maximum_returned_matches >= sorted_distance_list.size() ? sorted_distance_list.size()
-			                                                                    : db_metadata.maximum_returned_matches;
+	return rerank(candidates.take_sorted(), sorted_query, query_shape_id, store, metadata);
+}
+
+std::vector<ShapeMatch>
+FeatureMatching::get_similar_shapes_global(const FeatureVector &query, int query_shape_id,
+                                           const FeatureStore &store, const DatabaseMetadata &metadata) {
+	const FeatureVector sorted_query = FeatureStore::sorted_feature_vector(query);
+	const DimensionScales scales = dimension_scales(metadata);
+
+	// With no negative weight the global part is a lower bound of the squared distance, so shapes beyond the
+	// threshold by it alone are beyond it in full
+	const bool can_prune = std::all_of(scales.begin(), scales.end(), [](double scale) { return scale >= 0; });
+	const double maximum_partial_distance = can_prune ? metadata.maximum_feature_matching_distance
+	                                                    * metadata.maximum_feature_matching_distance : INFINITY;
 
-	returned_sorted_distance_list.reserve(maximum_returned_matches);
-	for (int i = 0; i < maximum_returned_matches; i++)
-		returned_sorted_distance_list.push_back(sorted_shape_list[i]);
+	TopK candidates(candidate_pool_size(metadata));
+	double partial_distances[STANDARD_SCAN_BLOCK_SIZE];
 
-	return returned_sorted_distance_list;
+	for (int block_start = 0; block_start < store.size(); block_start += STANDARD_SCAN_BLOCK_SIZE) {
+		const int block_size = std::min(STANDARD_SCAN_BLOCK_SIZE, store.size() - block_start);
+		std::fill_n(partial_distances, block_size, 0.0);
+
+		for (int i = 0; i < GLOBAL_DESCRIPTOR_COUNT; i++) {
+			const double *column = store.global_descriptor((GlobalDescriptor) i) + block_start;
+			const double query_value = sorted_query.values[i];
+			const double scale = scales[i];
+
+			for (int j = 0; j < block_size; j++)
+				partial_distances[j] += scale * std::abs(query_value - column[j]);
+		}
+
+		for (int j = 0; j < block_size; j++) {
+			if (partial_distances[j] < maximum_partial_distance && candidates.accepts(partial_distances[j]))
+				candidates.push(block_start + j, partial_distances[j]);
+		}
+	}
+
+	return rerank(candidates.take_sorted(), sorted_query, query_shape_id, store, metadata);
 }
 
-double FeatureMatching::get_feature_distance(DatabaseShape shape_a, DatabaseShape shape_b) {
-	double a = Util::euclidean_distance(shape_a.surface_area_normalized, shape_b.surface_area_normalized);
-	double b = Util::euclidean_distance(shape_a.compactness_normalized, shape_b.compactness_normalized);
-	double c = Util::euclidean_distance(shape_a.volume_normalized, shape_b.volume_normalized);
-	double d = Util::euclidean_distance(shape_a.diameter_normalized, shape_b.diameter_normalized);
-	double e = Util::euclidean_distance(shape_a.eccentricity_normalized, shape_b.eccentricity_normalized);
+std::vector<ShapeMatch>
+FeatureMatching::rerank(const std::vector<ShapeMatch> &candidates, const FeatureVector &sorted_query,
+                        int query_shape_id, const FeatureStore &store,
+                        const DatabaseMetadata &metadata) {
+	TopK similar_shapes(metadata.maximum_returned_matches);
 
-	std::vector<double> weight{0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1}; // 0.1 * 10 = 1
+	for (const ShapeMatch &candidate : candidates) {
+		if (candidate.shape_id == query_shape_id)
+			continue;
 
-	double f = wasserstein(shape_a.a3, weight, shape_b.a3, weight);
-	double g = wasserstein(shape_a.d1, weight, shape_b.d1, weight);
-	double h = wasserstein(shape_a.d2, weight, shape_b.d2, weight);
-	double i = wasserstein(shape_a.d3, weight, shape_b.d3, weight);
-	double j = wasserstein(shape_a.d4, weight, shape_b.d4, weight);
+		double distance = std::sqrt(FeatureMatching::get_feature_distance(sorted_query, store, candidate.shape_id,
+		                                                                   metadata));
+
+		if (distance < metadata.maximum_feature_matching_distance)
+			similar_shapes.push(candidate.shape_id, distance);
+	}
+
+	return similar_shapes.take_sorted();
+}
+
+double FeatureMatching::get_feature_distance(const FeatureVector &sorted_query, const FeatureStore &store,
+                                             int shape_id, const DatabaseMetadata &metadata) {
+	double a = Util::euclidean_distance(sorted_query.values[SURFACE_AREA],
+	                                    store.global_descriptor(SURFACE_AREA)[shape_id]);
+	double b = Util::euclidean_distance(sorted_query.values[COMPACTNESS],
+	                                    store.global_descriptor(COMPACTNESS)[shape_id]);
+	double c = Util::euclidean_distance(sorted_query.values[VOLUME],
+	                                    store.global_descriptor(VOLUME)[shape_id]);
+	double d = Util::euclidean_distance(sorted_query.values[DIAMETER],
+	                                    store.global_descriptor(DIAMETER)[shape_id]);
+	double e = Util::euclidean_distance(sorted_query.values[ECCENTRICITY],
+	                                    store.global_descriptor(ECCENTRICITY)[shape_id]);
+
+	double histogram_distances[PROPERTY_DESCRIPTOR_COUNT];
+
+	for (int i = 0; i < PROPERTY_DESCRIPTOR_COUNT; i++) {
+		const double *query_histogram = sorted_query.values + GLOBAL_DESCRIPTOR_COUNT + i * HISTOGRAM_BAR_COUNT;
+		const double *shape_histogram = store.sorted_histogram((PropertyDescriptor) i, shape_id);
+
+		histogram_distances[i] = Emd::quantile_distance(query_histogram, shape_histogram);
+	}
+
+	double f = histogram_distances[A3];
+	double g = histogram_distances[D1];
+	double h = histogram_distances[D2];
+	double i = histogram_distances[D3];
+	double j = histogram_distances[D4];
 
 	// Note: all weights should add up to one.
 	// We do not test for this at the moment, so we trust our end-users to do this.
 	// This is never going to cause problems or weird results, since all our end-users read manuals.
-	const DatabaseMetadata db_metadata = Database::metadata();
-	double weight_surface_area = db_metadata.weight_surface_area;
-	double weight_compactness = db_metadata.weight_compactness;
-	double weight_volume = db_metadata.weight_volume;
-	double weight_diameter = db_metadata.weight_diameter;
-	double weight_eccentricity = db_metadata.weight_eccentricity;
-	double weight_A3 = db_metadata.weight_A3;
-	double weight_D1 = db_metadata.weight_D1;
-	double weight_D2 = db_metadata.weight_D2;
-	double weight_D3 = db_metadata.weight_D3;
-	double weight_D4 = db_metadata.weight_D4;
+	double weight_surface_area = metadata.weight_surface_area;
+	double weight_compactness = metadata.weight_compactness;
+	double weight_volume = metadata.weight_volume;
+	double weight_diameter = metadata.weight_diameter;
+	double weight_eccentricity = metadata.weight_eccentricity;
+	double weight_A3 = metadata.weight_A3;
+	double weight_D1 = metadata.weight_D1;
+	double weight_D2 = metadata.weight_D2;
+	double weight_D3 = metadata.weight_D3;
+	double weight_D4 = metadata.weight_D4;
 
 	return (a * weight_surface_area + b * weight_compactness + c * weight_volume + d * weight_diameter +
 	        e * weight_eccentricity + f * weight_A3 + g * weight_D1 +
 	        h * weight_D2 + i * weight_D3 + j * weight_D4);
 }
 
-std::vector<DatabaseShape>
-FeatureMatching::get_similar_shapes_ann(const DatabaseShape &input_shape,
-                                        std::vector<DatabaseShape> database_shapes,
-                                        Util::FeatureMatchingMethod search_type) {
-	std::vector<DatabaseShape> similar_shapes;
+DimensionScales FeatureMatching::dimension_scales(const DatabaseMetadata &metadata) {
+	const double global_weights[GLOBAL_DESCRIPTOR_COUNT] = {
+			metadata.weight_surface_area, metadata.weight_compactness, metadata.weight_volume,
+			metadata.weight_diameter, metadata.weight_eccentricity
+	};
+	const double histogram_weights[PROPERTY_DESCRIPTOR_COUNT] = {
+			metadata.weight_A3, metadata.weight_D1, metadata.weight_D2, metadata.weight_D3, metadata.weight_D4
+	};
 
-	std::string query_feature_vector = get_feature_vector_as_string(input_shape);
-	std::string database_feature_vectors;
+	DimensionScales scales{};
 
-	for (int i = 0; i < database_shapes.size(); i++) {
-		DatabaseShape shape = database_shapes[i];
+	for (int i = 0; i < GLOBAL_DESCRIPTOR_COUNT; i++)
+		scales[i] = global_weights[i];
 
-		if (i == database_shapes.size() - 1)
-			database_feature_vectors += get_feature_vector_as_string(shape);
-		else
-			database_feature_vectors += get_feature_vector_as_string(shape) + "\n";
-	}
+	for (int i = 0; i < PROPERTY_DESCRIPTOR_COUNT; i++)
+		std::fill_n(scales.begin() + GLOBAL_DESCRIPTOR_COUNT + i * HISTOGRAM_BAR_COUNT, HISTOGRAM_BAR_COUNT,
+		            histogram_weights[i] / HISTOGRAM_BAR_COUNT);
 
-	std::vector<int> similar_shapes_indices = get_similar_shapes_indices(query_feature_vector, database_feature_vectors,
-	                                                                     database_shapes.size(), search_type);
-
-	similar_shapes.reserve(similar_shapes_indices.size());
-	for (int shape_index : similar_shapes_indices)
-		similar_shapes.push_back(database_shapes[shape_index]);
-
-	return similar_shapes;
+	return scales;
 }
 
-std::string FeatureMatching::get_feature_vector_as_string(const DatabaseShape &shape) {
-	std::string feature_vector_string = std::to_string(shape.surface_area_normalized)
-	                                    + " " + std::to_string(shape.compactness_normalized)
-	                                    + " " + std::to_string(shape.volume_normalized)
-	                                    + " " + std::to_string(shape.diameter_normalized)
-	                                    + " " + std::to_string(shape.eccentricity_normalized);
-
-	for (double i : shape.a3)
-		feature_vector_string += " " + std::to_string(i);
-	for (double i : shape.d1)
-		feature_vector_string += " " + std::to_string(i);
-	for (double i : shape.d2)
-		feature_vector_string += " " + std::to_string(i);
-	for (double i : shape.d3)
-		feature_vector_string += " " + std::to_string(i);
-	for (double i : shape.d4)
-		feature_vector_string += " " + std::to_string(i);
-
-	return feature_vector_string;
+uint64_t FeatureMatching::checksum(const DimensionScales &scales) {
+	return Util::hash(scales.data(), scales.size() * sizeof(double));
 }
 
-std::vector<int>
-FeatureMatching::get_similar_shapes_indices(const std::string &query_feature_vector,
-                                            const std::string &database_feature_vectors,
-                                            int database_shape_count,
-                                            Util::FeatureMatchingMethod search_type) {
-	const DatabaseMetadata db_metadata = Database::metadata();
-
-	std::vector<int> similar_shapes_indices;
-
-	int k = db_metadata.maximum_returned_matches; // number of nearest neighbors
-	int dim = HISTOGRAM_BAR_COUNT * 5 + 5; // dimension
-	double eps = 0; // error bound
-
-	int nPts = 0; // actual number of data points
-	ANNpointArray dataPts = annAllocPts(database_shape_count, dim); // allocate data points
-	ANNpoint queryPt = annAllocPt(dim); // allocate query point
-	auto nnIdx = new ANNidx[k]; // allocate near neigh indices
-	auto dists = new ANNdist[k]; // allocate near neighbor dists
+void FeatureMatching::scaled_features(const FeatureStore &store, int shape_id, const DimensionScales &scales,
+                                      double *point) {
+	for (int i = 0; i < GLOBAL_DESCRIPTOR_COUNT; i++)
+		point[i] = store.global_descriptor((GlobalDescriptor) i)[shape_id];
 
-	std::istringstream query_stream(query_feature_vector);
-	std::istream *queryIn = &query_stream; // input for query points
-
-	std::istringstream data_stream(database_feature_vectors);
-	std::istream *dataIn = &data_stream; // input for data points
+	for (int i = 0; i < PROPERTY_DESCRIPTOR_COUNT; i++) {
+		const double *histogram = store.sorted_histogram((PropertyDescriptor) i, shape_id);
+		std::copy(histogram, histogram + HISTOGRAM_BAR_COUNT,
+		          point + GLOBAL_DESCRIPTOR_COUNT + i * HISTOGRAM_BAR_COUNT);
+	}
 
-	while (read_point(*dataIn, dataPts[nPts], dim))
-		nPts++;
+	for (int i = 0; i < FEATURE_VECTOR_DIMENSION; i++)
+		point[i] *= scales[i];
+}
 
-	auto *kdTree = new ANNkd_tree( // build search structure
-			dataPts, // the data points
-			nPts, // number of points
-			dim); // dimension of space
+void FeatureMatching::scaled_features(const FeatureVector &query, const DimensionScales &scales, double *point) {
+	const FeatureVector sorted_query = FeatureStore::sorted_feature_vector(query);
 
-	while (read_point(*queryIn, queryPt, dim)) // read query points
-	{
-		if (search_type == Util::FeatureMatchingMethod::KNN) {
-			kdTree->annkSearch( // search
-					queryPt, // query point
-					k, // number of near neighbors
-					nnIdx, // nearest neighbors (returned)
-					dists, // distance (returned)
-					eps); // error bound
+	for (int i = 0; i < FEATURE_VECTOR_DIMENSION; i++)
+		point[i] = sorted_query.values[i] * scales[i];
+}
 
-			// Debug
-			//std::cout << "\tNN:\tIndex\tDistance\n";
+std::vector<ShapeMatch>
+FeatureMatching::get_similar_shapes_ann(const FeatureVector &query, int query_shape_id, const FeatureStore &store,
+                                        const DatabaseMetadata &metadata, Util::FeatureMatchingMethod search_type) {
+	// A shard's index is weighted with that shard's metadata, which need not be the metadata matched with
+	if (store.ann_index() != nullptr && store.ann_index()->is_weighted_for(metadata))
+		return store.ann_index()->search(query, query_shape_id, metadata, search_type);
 
-			for (int i = 0; i < k; i++) {
-				dists[i] = sqrt(dists[i]); // Un-square distance
+	return AnnIndex::build(store, metadata)->search(query, query_shape_id, metadata, search_type);
+}
 
-				similar_shapes_indices.push_back(nnIdx[i]);
+std::vector<ShapeMatch>
+FeatureMatching::get_similar_shapes_hnsw(const FeatureVector &query, int query_shape_id,
+                                         const FeatureStore &store, const DatabaseMetadata &metadata) {
+	if (store.hnsw_index() != nullptr && store.hnsw_index()->is_weighted_for(metadata))
+		return store.hnsw_index()->search(query, query_shape_id, metadata);
 
-				// Debug
-				//std::cout << "\t" << i << "\t" << nnIdx[i] << "\t" << dists[i] << std::endl;
-			}
-		} else if (search_type == Util::FeatureMatchingMethod::RNN) {
-			ANNdist square_radius =
-					db_metadata.maximum_feature_matching_distance * db_metadata.maximum_feature_matching_distance;
-
-			kdTree->annkFRSearch( // search
-					queryPt, // query point
-					square_radius, // square distance
-					k, // number of near neighbors
-					nnIdx, // nearest neighbors (returned)
-					dists, // distance (returned)
-					eps); // error bound
-
-			// Debug
-			//std::cout << "\tNN:\tIndex\tDistance\n";
-
-			for (int i = 0; i < k; i++) {
-				dists[i] = sqrt(dists[i]); // unsquare distance
-
-				if (nnIdx[i] >= 0)
-					similar_shapes_indices.push_back(nnIdx[i]);
-
-				// Debug
-				//if (nnIdx[i] >= 0)
-				//	std::cout << "\t" << i << "\t" << nnIdx[i] << "\t" << dists[i] << std::endl;
-			}
-		}
-	}
+	return HnswIndex::build(store, metadata)->search(query, query_shape_id, metadata);
+}
 
-	delete[] nnIdx;
-	delete[] dists;
-	delete kdTree;
+std::vector<ShapeMatch>
+FeatureMatching::get_similar_shapes_pq(const FeatureVector &query, int query_shape_id,
+                                       const FeatureStore &store, const DatabaseMetadata &metadata) {
+	const int candidate_count = candidate_pool_size(metadata);
+	const FeatureVector sorted_query = FeatureStore::sorted_feature_vector(query);
 
-	annClose();
+	const std::vector<ShapeMatch> candidates = store.pq_index() != nullptr
+	                                           ? store.pq_index()->search(query, metadata, candidate_count)
+	                                           : PqIndex::build(store)->search(query, metadata, candidate_count);
 
-	return similar_shapes_indices;
+	return rerank(candidates, sorted_query, query_shape_id, store, metadata);
 }
 
-bool FeatureMatching::read_point(std::istream &in, ANNpoint p, int dim) {
-	for (int i = 0; i < dim; i++) {
-		if (!(in >> p[i]))
-			return false;
-	}
+std::vector<ShapeMatch>
+FeatureMatching::get_similar_shapes_ivf(const FeatureVector &query, int query_shape_id,
+                                        const FeatureStore &store, const DatabaseMetadata &metadata) {
+	const FeatureVector sorted_query = FeatureStore::sorted_feature_vector(query);
+
+	const std::vector<int> shape_ids = store.ivf_index() != nullptr && store.ivf_index()->is_weighted_for(metadata)
+	                                   ? store.ivf_index()->search(query, metadata)
+	                                   : IvfIndex::build(store, metadata)->search(query, metadata);
 
-	return true;
+	// Nearest lists come first, so the bound the scan abandons shapes at tightens early
+	TopK similar_shapes(metadata.maximum_returned_matches);
+	scan_standard(sorted_query, query_shape_id, store, metadata, shape_ids.data(), 0, shape_ids.size(), similar_shapes);
+	return similar_shapes.take_sorted();
 }
@@ -1,30 +1,98 @@
 #pragma once
 
-#include <ANN/ANN.h>
+#include <array>
+#include "config.h"
 #include "database_mr.h"
+#include "feature_store.h"
+#include "top_k.h"
 #include "util.h"
 
+// Per-dimension factors under which the L1 distance between two sorted feature vectors is the squared STD distance
+typedef std::array<double, FEATURE_VECTOR_DIMENSION> DimensionScales;
+
+struct ShardMatch {
+	int shard; // Index into the list of stores that was searched
+	int shape_id;
+	double distance;
+};
+
 class FeatureMatching {
 public:
-	static std::vector<DatabaseShape>
-	get_similar_shapes(const DatabaseShape& input_shape, const std::vector<DatabaseShape>& database_shapes,
-	                   Util::FeatureMatchingMethod search_type);
+	// Returns the most similar shapes in the store, most similar first. query_shape_id is the id of the query in the
+	// store, which is never returned, or -1 if the query is not one of its shapes.
+	static std::vector<ShapeMatch>
+	get_similar_shapes(const FeatureVector& query, int query_shape_id, const FeatureStore& store,
+	                   const DatabaseMetadata& metadata, Util::FeatureMatchingMethod search_type);
+
+	// Searches every store in parallel and merges the results into one global top-k by distance. The query is shape
+	// query_shape_id of stores[query_shard], or query_shard is -1.
+	static std::vector<ShardMatch>
+	get_similar_shapes_federated(const FeatureVector& query, int query_shard, int query_shape_id,
+	                             const std::vector<FeatureStore>& stores, const DatabaseMetadata& metadata,
+	                             Util::FeatureMatchingMethod search_type);
+
+	// The weight of every global descriptor, and the weight of every histogram divided by its bar count, as the EMD of
+	// two histograms is the mean difference of their sorted bars. The indexes search in this space.
+	static DimensionScales dimension_scales(const DatabaseMetadata& metadata);
+
+	static uint64_t checksum(const DimensionScales& scales);
+
+	// Writes the sorted features of a shape of the store, multiplied by scales, to point
+	static void scaled_features(const FeatureStore& store, int shape_id, const DimensionScales& scales, double* point);
+
+	// Writes the sorted features of a query, multiplied by scales, to point
+	static void scaled_features(const FeatureVector& query, const DimensionScales& scales, double* point);
 
 private:
-	static std::vector<DatabaseShape>
-	get_similar_shapes_standard(DatabaseShape input_shape, const std::vector<DatabaseShape>& database_shapes);
+	static std::vector<ShapeMatch>
+	search(const FeatureVector& query, int query_shape_id, const FeatureStore& store,
+	       const DatabaseMetadata& metadata, Util::FeatureMatchingMethod search_type);
+
+	static std::vector<ShapeMatch>
+	get_similar_shapes_standard(const FeatureVector& query, int query_shape_id,
+	                            const FeatureStore& store, const DatabaseMetadata& metadata);
+
+	// Offers the shapes begin to end of the store to similar_shapes, with their STD distances. If shape_ids is given,
+	// offers the shapes shape_ids[begin] to shape_ids[end - 1] instead.
+	static void scan_standard(const FeatureVector& sorted_query, int query_shape_id,
+	                          const FeatureStore& store, const DatabaseMetadata& metadata, const int* shape_ids,
+	                          int begin, int end, TopK& similar_shapes);
+
+	// sorted_query as returned by FeatureStore::sorted_feature_vector()
+	static double get_feature_distance(const FeatureVector& sorted_query, const FeatureStore& store, int shape_id,
+	                                   const DatabaseMetadata& metadata);
+
+	static std::vector<ShapeMatch>
+	get_similar_shapes_ann(const FeatureVector& query, int query_shape_id, const FeatureStore& store,
+	                       const DatabaseMetadata& metadata, Util::FeatureMatchingMethod search_type);
+
+	// STD ranking of the candidate_pool_multiplier * maximum_returned_matches shapes whose feature codes are nearest
+	static std::vector<ShapeMatch>
+	get_similar_shapes_quantized(const FeatureVector& query, int query_shape_id,
+	                             const FeatureStore& store, const DatabaseMetadata& metadata);
 
-	static double get_feature_distance(DatabaseShape shape_a, DatabaseShape shape_b);
+	static std::vector<ShapeMatch>
+	get_similar_shapes_hnsw(const FeatureVector& query, int query_shape_id,
+	                        const FeatureStore& store, const DatabaseMetadata& metadata);
 
-	static std::vector<DatabaseShape>
-	get_similar_shapes_ann(const DatabaseShape& input_shape, std::vector<DatabaseShape> database_shapes,
-	                       Util::FeatureMatchingMethod search_type);
+	// STD ranking of the candidate_pool_multiplier * maximum_returned_matches shapes whose PQ codes are nearest
+	static std::vector<ShapeMatch>
+	get_similar_shapes_pq(const FeatureVector& query, int query_shape_id, const FeatureStore& store,
+	                      const DatabaseMetadata& metadata);
 
-	static std::string get_feature_vector_as_string(const DatabaseShape& shape);
+	// STD ranking of the candidate_pool_multiplier * maximum_returned_matches shapes nearest by their global descriptors
+	// alone, which are read from five columns instead of a row of every histogram
+	static std::vector<ShapeMatch>
+	get_similar_shapes_global(const FeatureVector& query, int query_shape_id,
+	                          const FeatureStore& store, const DatabaseMetadata& metadata);
 
-	static std::vector<int>
-	get_similar_shapes_indices(const std::string& query_feature_vector, const std::string& database_feature_vectors,
-	                           int database_shape_count, Util::FeatureMatchingMethod search_type);
+	// STD scan of the shapes in the ivf_probe_count posting lists nearest to the query
+	static std::vector<ShapeMatch>
+	get_similar_shapes_ivf(const FeatureVector& query, int query_shape_id, const FeatureStore& store,
+	                       const DatabaseMetadata& metadata);
 
-	static bool read_point(std::istream &in, ANNpoint p, int dim);
+	// STD ranking of candidates, skipping the query itself and shapes beyond maximum_feature_matching_distance
+	static std::vector<ShapeMatch>
+	rerank(const std::vector<ShapeMatch>& candidates, const FeatureVector& sorted_query,
+	       int query_shape_id, const FeatureStore& store, const DatabaseMetadata& metadata);
 };
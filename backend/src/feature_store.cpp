@@ -0,0 +1,642 @@
+#include "feature_store.h"
+#include <boost/align/aligned_allocator.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <sstream>
+#include "ann_index.h"
+#include "hnsw_index.h"
+#include "ivf_index.h"
+#include "pq_index.h"
+#include "preprocessing.h"
+
+/*
+ * Snapshot layout. Every section starts on a FEATURE_STORE_ALIGNMENT boundary, so the in-memory image and the
+ * memory-mapped file can be read through the same pointers:
+ * - FeatureSnapshotHeader
+ * - GLOBAL_DESCRIPTOR_COUNT columns of shape_count doubles
+ * - PROPERTY_DESCRIPTOR_COUNT columns of shape_count * HISTOGRAM_BAR_COUNT doubles
+ * - The same columns again, with the bars of every histogram sorted
+ * - FeatureQuantization
+ * - shape_count rows of FEATURE_CODE_STRIDE feature codes, quantized from the sorted columns
+ * - shape_count + 1 offsets (uint64) into the filename characters
+ * - shape_count shape ids (int32) in filename order, those of equal filenames in id order
+ * - Filename characters, not null-terminated
+ */
+
+static const char FEATURE_SNAPSHOT_MAGIC[8] = {'M', 'R', 'F', 'E', 'A', 'T', 'S', '\0'};
+static const uint32_t FEATURE_SNAPSHOT_VERSION = 5;
+
+typedef std::vector<char, boost::alignment::aligned_allocator<char, FEATURE_STORE_ALIGNMENT>> AlignedCharVector;
+
+static uint64_t aligned_size(uint64_t size) {
+	return (size + FEATURE_STORE_ALIGNMENT - 1) / FEATURE_STORE_ALIGNMENT * FEATURE_STORE_ALIGNMENT;
+}
+
+static uint64_t header_size() {
+	return aligned_size(sizeof(FeatureSnapshotHeader));
+}
+
+static uint64_t global_descriptor_column_size(uint64_t shape_count) {
+	return aligned_size(shape_count * sizeof(double));
+}
+
+static uint64_t property_descriptor_column_size(uint64_t shape_count) {
+	return aligned_size(shape_count * HISTOGRAM_BAR_COUNT * sizeof(double));
+}
+
+static uint64_t global_descriptor_offset(int global_descriptor, uint64_t shape_count) {
+	return header_size() + global_descriptor * global_descriptor_column_size(shape_count);
+}
+
+static uint64_t property_descriptor_offset(int property_descriptor, uint64_t shape_count) {
+	return global_descriptor_offset(GLOBAL_DESCRIPTOR_COUNT, shape_count)
+	       + property_descriptor * property_descriptor_column_size(shape_count);
+}
+
+static uint64_t sorted_property_descriptor_offset(int property_descriptor, uint64_t shape_count) {
+	return property_descriptor_offset(PROPERTY_DESCRIPTOR_COUNT + property_descriptor, shape_count);
+}
+
+static uint64_t quantization_offset(uint64_t shape_count) {
+	return sorted_property_descriptor_offset(PROPERTY_DESCRIPTOR_COUNT, shape_count);
+}
+
+static uint64_t codes_offset(uint64_t shape_count) {
+	return quantization_offset(shape_count) + aligned_size(sizeof(FeatureQuantization));
+}
+
+static uint64_t filename_offsets_offset(uint64_t shape_count) {
+	return codes_offset(shape_count) + aligned_size(shape_count * FEATURE_CODE_STRIDE);
+}
+
+static uint64_t sorted_shape_ids_offset(uint64_t shape_count) {
+	return filename_offsets_offset(shape_count) + aligned_size((shape_count + 1) * sizeof(uint64_t));
+}
+
+static uint64_t filename_characters_offset(uint64_t shape_count) {
+	return sorted_shape_ids_offset(shape_count) + aligned_size(shape_count * sizeof(int32_t));
+}
+
+uint64_t FeatureStore::checksum(const DatabaseStatistics &statistics) {
+	const RunningStatistics descriptors[] = {statistics.surface_area, statistics.compactness, statistics.volume,
+	                                         statistics.diameter, statistics.eccentricity};
+
+	uint64_t checksum = Util::hash(nullptr, 0);
+
+	for (const RunningStatistics &descriptor : descriptors) {
+		const int64_t count = descriptor.count;
+		checksum = Util::hash(&count, sizeof(count), checksum);
+		checksum = Util::hash(&descriptor.mean, sizeof(descriptor.mean), checksum);
+		checksum = Util::hash(&descriptor.m2, sizeof(descriptor.m2), checksum);
+	}
+
+	return checksum;
+}
+
+static void quantize(const FeatureQuantization &quantization, const double *sorted_features, uint8_t *codes) {
+	for (int i = 0; i < FEATURE_VECTOR_DIMENSION; i++) {
+		if (quantization.step[i] > 0)
+			codes[i] = (uint8_t) std::lround((sorted_features[i] - quantization.minimum[i]) / quantization.step[i]);
+	}
+}
+
+FeatureStore FeatureStore::from_shapes(const std::vector<DatabaseShape> &normalized_shapes, int generation,
+                                       const DatabaseStatistics &statistics) {
+	const uint64_t shape_count = normalized_shapes.size();
+
+	uint64_t filename_characters_size = 0;
+	for (const DatabaseShape &shape : normalized_shapes)
+		filename_characters_size += shape.filename.size();
+
+	const uint64_t size = filename_characters_offset(shape_count) + filename_characters_size;
+	auto image = std::make_shared<AlignedCharVector>(size, 0);
+	char *image_data = image->data();
+
+	auto *header = reinterpret_cast<FeatureSnapshotHeader *>(image_data);
+	std::memcpy(header->magic, FEATURE_SNAPSHOT_MAGIC, sizeof(header->magic));
+	header->version = FEATURE_SNAPSHOT_VERSION;
+	header->dimension = FEATURE_VECTOR_DIMENSION;
+	header->shape_count = shape_count;
+	header->generation = generation;
+	header->statistics_checksum = checksum(statistics);
+	header->size = size;
+
+	auto *quantization = reinterpret_cast<FeatureQuantization *>(image_data + quantization_offset(shape_count));
+	auto *codes = reinterpret_cast<uint8_t *>(image_data + codes_offset(shape_count));
+	auto *filename_offsets = reinterpret_cast<uint64_t *>(image_data + filename_offsets_offset(shape_count));
+	char *filename_characters = image_data + filename_characters_offset(shape_count);
+	filename_offsets[0] = 0;
+
+	double maximum[FEATURE_VECTOR_DIMENSION];
+	std::fill_n(quantization->minimum, FEATURE_VECTOR_DIMENSION, shape_count == 0 ? 0 : INFINITY);
+	std::fill_n(maximum, FEATURE_VECTOR_DIMENSION, shape_count == 0 ? 0 : -INFINITY);
+
+	for (uint64_t shape_id = 0; shape_id < shape_count; shape_id++) {
+		const DatabaseShape &shape = normalized_shapes[shape_id];
+		FeatureVector features = feature_vector(shape);
+		FeatureVector sorted_features = sorted_feature_vector(shape);
+
+		for (int i = 0; i < GLOBAL_DESCRIPTOR_COUNT; i++) {
+			auto *column = reinterpret_cast<double *>(image_data + global_descriptor_offset(i, shape_count));
+			column[shape_id] = features.values[i];
+		}
+
+		for (int i = 0; i < PROPERTY_DESCRIPTOR_COUNT; i++) {
+			auto *column = reinterpret_cast<double *>(image_data + property_descriptor_offset(i, shape_count));
+			const double *histogram = features.values + GLOBAL_DESCRIPTOR_COUNT + i * HISTOGRAM_BAR_COUNT;
+			std::copy(histogram, histogram + HISTOGRAM_BAR_COUNT, column + shape_id * HISTOGRAM_BAR_COUNT);
+
+			auto *sorted_column = reinterpret_cast<double *>(image_data
+			                                                 + sorted_property_descriptor_offset(i, shape_count));
+			const double *sorted_histogram = sorted_features.values + GLOBAL_DESCRIPTOR_COUNT + i * HISTOGRAM_BAR_COUNT;
+			std::copy(sorted_histogram, sorted_histogram + HISTOGRAM_BAR_COUNT,
+			          sorted_column + shape_id * HISTOGRAM_BAR_COUNT);
+		}
+
+		for (int i = 0; i < FEATURE_VECTOR_DIMENSION; i++) {
+			quantization->minimum[i] = std::min(quantization->minimum[i], sorted_features.values[i]);
+			maximum[i] = std::max(maximum[i], sorted_features.values[i]);
+		}
+
+		std::memcpy(filename_characters + filename_offsets[shape_id], shape.filename.data(), shape.filename.size());
+		filename_offsets[shape_id + 1] = filename_offsets[shape_id] + shape.filename.size();
+	}
+
+	auto *sorted_shape_ids = reinterpret_cast<int32_t *>(image_data + sorted_shape_ids_offset(shape_count));
+	std::iota(sorted_shape_ids, sorted_shape_ids + shape_count, 0);
+	std::stable_sort(sorted_shape_ids, sorted_shape_ids + shape_count, [&](int32_t a, int32_t b) {
+		return normalized_shapes[a].filename < normalized_shapes[b].filename;
+	});
+
+	for (int i = 0; i < FEATURE_VECTOR_DIMENSION; i++)
+		quantization->step[i] = (maximum[i] - quantization->minimum[i]) / UINT8_MAX;
+
+	// Coded from the columns written above, once the range of every dimension is known
+	for (uint64_t shape_id = 0; shape_id < shape_count; shape_id++) {
+		double sorted_features[FEATURE_VECTOR_DIMENSION];
+
+		for (int i = 0; i < GLOBAL_DESCRIPTOR_COUNT; i++)
+			sorted_features[i] = reinterpret_cast<const double *>(image_data
+			                                                      + global_descriptor_offset(i, shape_count))[shape_id];
+
+		for (int i = 0; i < PROPERTY_DESCRIPTOR_COUNT; i++) {
+			const auto *sorted_column = reinterpret_cast<const double *>(
+					image_data + sorted_property_descriptor_offset(i, shape_count));
+			const double *sorted_histogram = sorted_column + shape_id * HISTOGRAM_BAR_COUNT;
+			std::copy(sorted_histogram, sorted_histogram + HISTOGRAM_BAR_COUNT,
+			          sorted_features + GLOBAL_DESCRIPTOR_COUNT + i * HISTOGRAM_BAR_COUNT);
+		}
+
+		quantize(*quantization, sorted_features, codes + shape_id * FEATURE_CODE_STRIDE);
+	}
+
+	header->payload_checksum = Util::hash(image_data + header_size(), size - header_size());
+	header->header_checksum = Util::hash(header, offsetof(FeatureSnapshotHeader, header_checksum));
+
+	FeatureStore store;
+	store.set_pointers(image_data);
+	store.storage = image;
+	return store;
+}
+
+FeatureStore FeatureStore::load(const Database &database, bool print) {
+	return load(database, database.statistics(), print);
+}
+
+FeatureStore FeatureStore::load(const Database &database, const DatabaseStatistics &statistics, bool print) {
+	FeatureStore store = load_snapshot(database, statistics, print);
+	const DatabaseMetadata metadata = database.metadata();
+	const bool persist = !database.is_read_only();
+	store.load_ann_index(database.path(), metadata, persist, print);
+	store.load_hnsw_index(database.path(), metadata, persist, print);
+	store.load_pq_index(database.path(), persist, print);
+	store.load_ivf_index(database.path(), metadata, persist, print);
+	return store;
+}
+
+FeatureStore FeatureStore::load_snapshot(const Database &database, const DatabaseStatistics &statistics, bool print) {
+	const DatabaseMetadata metadata = database.metadata();
+	const boost::filesystem::path path = snapshot_path(database.path());
+
+	if (boost::filesystem::exists(path)) {
+		FeatureStore store = map(path);
+
+		if (store.header != nullptr
+		    && store.generation() == metadata.generation
+		    && store.header->statistics_checksum == checksum(statistics)
+		    && store.verify_once(path, !database.is_read_only()))
+			return store;
+	}
+
+	if (print)
+		std::cout << "Regenerating feature snapshot " << path.string() << std::endl;
+
+	FeatureStore store = from_shapes(Preprocessing::normalize_features_for_shapes(database.shapes(), statistics, false),
+	                                 metadata.generation, statistics);
+
+	// Written from the database, so it needs no verifying when queries map it
+	if (!database.is_read_only() && store.save(path))
+		store.record_verified(path);
+	else if (!database.is_read_only() && print)
+		std::cout << "Could not write feature snapshot " << path.string() << std::endl;
+
+	return store;
+}
+
+void FeatureStore::load_ann_index(const boost::filesystem::path &database_path, const DatabaseMetadata &metadata,
+                                  bool persist, bool print) {
+	const boost::filesystem::path path = AnnIndex::index_path(database_path);
+
+	// Without an index file (see --build-index) KNN, RNN and RANGE build a tree for every query
+	if (!boost::filesystem::exists(path))
+		return;
+
+	index = AnnIndex::load(path, *this, metadata);
+
+	if (index != nullptr)
+		return;
+
+	if (print)
+		std::cout << "Rebuilding ANN index " << path.string() << std::endl;
+
+	index = AnnIndex::build(*this, metadata);
+
+	if (persist && !index->save(path) && print)
+		std::cout << "Could not write ANN index " << path.string() << std::endl;
+}
+
+void FeatureStore::load_hnsw_index(const boost::filesystem::path &database_path, const DatabaseMetadata &metadata,
+                                   bool persist, bool print) {
+	const boost::filesystem::path path = HnswIndex::index_path(database_path);
+
+	// Without a graph file (see --build-index) HNSW builds a graph for every query
+	if (!boost::filesystem::exists(path))
+		return;
+
+	std::shared_ptr<HnswIndex> stored_graph = HnswIndex::load(path, *this, metadata);
+
+	if (stored_graph != nullptr && stored_graph->matches(*this)) {
+		graph = stored_graph;
+		return;
+	}
+
+	if (stored_graph != nullptr) {
+		if (print)
+			std::cout << "Inserting " << size() - stored_graph->size() << " shapes into HNSW index " << path.string()
+			          << std::endl;
+
+		stored_graph->insert_new_shapes(*this);
+	} else {
+		if (print)
+			std::cout << "Rebuilding HNSW index " << path.string() << std::endl;
+
+		stored_graph = HnswIndex::build(*this, metadata);
+	}
+
+	graph = stored_graph;
+
+	if (persist && !stored_graph->save(path) && print)
+		std::cout << "Could not write HNSW index " << path.string() << std::endl;
+}
+
+void FeatureStore::load_pq_index(const boost::filesystem::path &database_path, bool persist, bool print) {
+	const boost::filesystem::path path = PqIndex::index_path(database_path);
+
+	// Without an index file (see --build-index) PQ trains its codebooks for every query
+	if (!boost::filesystem::exists(path))
+		return;
+
+	product_quantizer = PqIndex::load(path, *this);
+
+	if (product_quantizer != nullptr)
+		return;
+
+	if (print)
+		std::cout << "Rebuilding PQ index " << path.string() << std::endl;
+
+	product_quantizer = PqIndex::build(*this);
+
+	if (persist && !product_quantizer->save(path) && print)
+		std::cout << "Could not write PQ index " << path.string() << std::endl;
+}
+
+void FeatureStore::load_ivf_index(const boost::filesystem::path &database_path, const DatabaseMetadata &metadata,
+                                  bool persist, bool print) {
+	const boost::filesystem::path path = IvfIndex::index_path(database_path);
+
+	// Without an index file (see --build-index) IVF trains its centroids for every query
+	if (!boost::filesystem::exists(path))
+		return;
+
+	std::shared_ptr<IvfIndex> stored_index = IvfIndex::load(path, *this, metadata);
+
+	if (stored_index != nullptr && stored_index->matches(*this)) {
+		inverted_file = stored_index;
+		return;
+	}
+
+	if (stored_index != nullptr && !stored_index->needs_retraining(*this)) {
+		if (print && stored_index->is_normalized_as(*this))
+			std::cout << "Inserting " << size() - stored_index->size() << " shapes into IVF index " << path.string()
+			          << std::endl;
+		else if (print)
+			std::cout << "Reassigning " << size() << " shapes to the centroids of IVF index " << path.string()
+			          << ", trained on " << stored_index->trained_size() << " shapes" << std::endl;
+
+		stored_index->insert_new_shapes(*this);
+	} else {
+		if (print)
+			std::cout << "Rebuilding IVF index " << path.string() << std::endl;
+
+		stored_index = IvfIndex::build(*this, metadata);
+	}
+
+	inverted_file = stored_index;
+
+	if (persist && !stored_index->save(path) && print)
+		std::cout << "Could not write IVF index " << path.string() << std::endl;
+}
+
+boost::filesystem::path FeatureStore::snapshot_path(const boost::filesystem::path &database_path) {
+	return database_path.string() + ".features";
+}
+
+FeatureStore FeatureStore::map(const boost::filesystem::path &path) {
+	FeatureStore store;
+
+	try {
+		boost::interprocess::file_mapping file(path.string().c_str(), boost::interprocess::read_only);
+		auto region = std::make_shared<boost::interprocess::mapped_region>(file, boost::interprocess::read_only);
+
+		if (region->get_size() < sizeof(FeatureSnapshotHeader))
+			return store;
+
+		const char *image = static_cast<const char *>(region->get_address());
+		if (!is_valid_header(*reinterpret_cast<const FeatureSnapshotHeader *>(image), region->get_size()))
+			return store;
+
+		store.set_pointers(image);
+		store.storage = region;
+	}
+	catch (boost::interprocess::interprocess_exception &e) {
+		store = FeatureStore();
+	}
+
+	return store;
+}
+
+bool FeatureStore::is_valid_header(const FeatureSnapshotHeader &header, uint64_t size) {
+	return std::memcmp(header.magic, FEATURE_SNAPSHOT_MAGIC, sizeof(header.magic)) == 0
+	       && header.header_checksum == Util::hash(&header, offsetof(FeatureSnapshotHeader, header_checksum))
+	       && header.version == FEATURE_SNAPSHOT_VERSION
+	       && header.dimension == FEATURE_VECTOR_DIMENSION
+	       && header.size == size
+	       && filename_characters_offset(header.shape_count) <= size;
+}
+
+void FeatureStore::set_pointers(const char *image) {
+	header = reinterpret_cast<const FeatureSnapshotHeader *>(image);
+	const uint64_t shape_count = header->shape_count;
+
+	for (int i = 0; i < GLOBAL_DESCRIPTOR_COUNT; i++)
+		global_descriptors[i] = reinterpret_cast<const double *>(image + global_descriptor_offset(i, shape_count));
+
+	for (int i = 0; i < PROPERTY_DESCRIPTOR_COUNT; i++) {
+		property_descriptors[i] = reinterpret_cast<const double *>(image + property_descriptor_offset(i, shape_count));
+		sorted_property_descriptors[i] = reinterpret_cast<const double *>(
+				image + sorted_property_descriptor_offset(i, shape_count));
+	}
+
+	feature_quantization = reinterpret_cast<const FeatureQuantization *>(image + quantization_offset(shape_count));
+	codes = reinterpret_cast<const uint8_t *>(image + codes_offset(shape_count));
+	filename_offsets = reinterpret_cast<const uint64_t *>(image + filename_offsets_offset(shape_count));
+	sorted_shape_ids = reinterpret_cast<const int32_t *>(image + sorted_shape_ids_offset(shape_count));
+	filename_characters = image + filename_characters_offset(shape_count);
+}
+
+bool FeatureStore::save(const boost::filesystem::path &path) const {
+	return Util::write_file_atomically(path, [&](std::ostream &file) {
+		file.write(reinterpret_cast<const char *>(header), header->size);
+	});
+}
+
+bool FeatureStore::verify() const {
+	const char *image = reinterpret_cast<const char *>(header);
+	return header->payload_checksum == Util::hash(image + header_size(), header->size - header_size());
+}
+
+bool FeatureStore::verify_once(const boost::filesystem::path &path, bool keep_record) const {
+	const std::string record = verification_record(path);
+
+	if (record.empty())
+		return verify();
+
+	std::ifstream record_file(path.string() + ".verified");
+	std::string recorded;
+	std::getline(record_file, recorded);
+
+	if (recorded == record)
+		return true;
+
+	if (!verify())
+		return false;
+
+	if (keep_record)
+		record_verified(path);
+
+	return true;
+}
+
+std::string FeatureStore::verification_record(const boost::filesystem::path &path) const {
+	// The record names the snapshot by its checksum, size and modification time, so a replaced snapshot is verified anew
+	boost::system::error_code error_code;
+	const std::time_t modified = boost::filesystem::last_write_time(path, error_code);
+
+	if (error_code)
+		return "";
+
+	std::ostringstream record;
+	record << header->payload_checksum << " " << header->size << " " << modified;
+	return record.str();
+}
+
+void FeatureStore::record_verified(const boost::filesystem::path &path) const {
+	const std::string record = verification_record(path);
+
+	if (record.empty())
+		return;
+
+	Util::write_file_atomically(path.string() + ".verified", [&](std::ostream &file) {
+		file << record << "\n";
+	});
+}
+
+FeatureVector FeatureStore::feature_vector(const DatabaseShape &normalized_shape) {
+	FeatureVector features{};
+
+	features.values[SURFACE_AREA] = normalized_shape.surface_area_normalized;
+	features.values[COMPACTNESS] = normalized_shape.compactness_normalized;
+	features.values[VOLUME] = normalized_shape.volume_normalized;
+	features.values[DIAMETER] = normalized_shape.diameter_normalized;
+	features.values[ECCENTRICITY] = normalized_shape.eccentricity_normalized;
+
+	const std::vector<double> *histograms[PROPERTY_DESCRIPTOR_COUNT] = {&normalized_shape.a3, &normalized_shape.d1,
+	                                                                    &normalized_shape.d2, &normalized_shape.d3,
+	                                                                    &normalized_shape.d4};
+
+	for (int i = 0; i < PROPERTY_DESCRIPTOR_COUNT; i++) {
+		for (int j = 0; j < HISTOGRAM_BAR_COUNT && j < histograms[i]->size(); j++)
+			features.values[GLOBAL_DESCRIPTOR_COUNT + i * HISTOGRAM_BAR_COUNT + j] = (*histograms[i])[j];
+	}
+
+	return features;
+}
+
+FeatureVector FeatureStore::sorted_feature_vector(const DatabaseShape &normalized_shape) {
+	DatabaseShape sorted_shape = normalized_shape;
+	sorted_shape.a3 = normalized_shape.a3_sorted;
+	sorted_shape.d1 = normalized_shape.d1_sorted;
+	sorted_shape.d2 = normalized_shape.d2_sorted;
+	sorted_shape.d3 = normalized_shape.d3_sorted;
+	sorted_shape.d4 = normalized_shape.d4_sorted;
+
+	return feature_vector(sorted_shape);
+}
+
+FeatureVector FeatureStore::sorted_feature_vector(const FeatureVector &features) {
+	FeatureVector sorted_features = features;
+
+	for (int i = 0; i < PROPERTY_DESCRIPTOR_COUNT; i++) {
+		double *histogram = sorted_features.values + GLOBAL_DESCRIPTOR_COUNT + i * HISTOGRAM_BAR_COUNT;
+		std::sort(histogram, histogram + HISTOGRAM_BAR_COUNT);
+	}
+
+	return sorted_features;
+}
+
+int FeatureStore::size() const {
+	return header == nullptr ? 0 : header->shape_count;
+}
+
+int FeatureStore::generation() const {
+	return header->generation;
+}
+
+uint64_t FeatureStore::statistics_checksum() const {
+	return header->statistics_checksum;
+}
+
+void FeatureStore::build_index_if_needed(const DatabaseMetadata &metadata, Util::FeatureMatchingMethod method) {
+	switch (method) {
+		case Util::FeatureMatchingMethod::STD:
+		case Util::FeatureMatchingMethod::SQ8:
+		case Util::FeatureMatchingMethod::GLOBAL:
+			break;
+		case Util::FeatureMatchingMethod::KNN:
+		case Util::FeatureMatchingMethod::RNN:
+		case Util::FeatureMatchingMethod::RANGE:
+			if (index == nullptr || !index->is_weighted_for(metadata))
+				index = AnnIndex::build(*this, metadata);
+			break;
+		case Util::FeatureMatchingMethod::HNSW:
+			if (graph == nullptr || !graph->is_weighted_for(metadata))
+				graph = HnswIndex::build(*this, metadata);
+			break;
+		case Util::FeatureMatchingMethod::PQ:
+			// Codebooks are trained on unweighted features and weighted per query, so other weights need no rebuild
+			if (product_quantizer == nullptr)
+				product_quantizer = PqIndex::build(*this);
+			break;
+		case Util::FeatureMatchingMethod::IVF:
+			if (inverted_file == nullptr || !inverted_file->is_weighted_for(metadata))
+				inverted_file = IvfIndex::build(*this, metadata);
+			break;
+	}
+}
+
+const AnnIndex *FeatureStore::ann_index() const {
+	return index.get();
+}
+
+const HnswIndex *FeatureStore::hnsw_index() const {
+	return graph.get();
+}
+
+const PqIndex *FeatureStore::pq_index() const {
+	return product_quantizer.get();
+}
+
+const IvfIndex *FeatureStore::ivf_index() const {
+	return inverted_file.get();
+}
+
+std::string FeatureStore::filename(int shape_id) const {
+	return std::string(filename_characters + filename_offsets[shape_id],
+	                   filename_offsets[shape_id + 1] - filename_offsets[shape_id]);
+}
+
+int FeatureStore::shape_id(const std::string &filename) const {
+	// Binary search of the shape ids in filename order, which finds the first of several shapes with this filename
+	const int32_t *end = sorted_shape_ids + size();
+	const int32_t *shape = std::lower_bound(sorted_shape_ids, end, filename, [&](int32_t id, const std::string &name) {
+		return compare_filename(id, name) < 0;
+	});
+
+	return shape != end && compare_filename(*shape, filename) == 0 ? *shape : -1;
+}
+
+int FeatureStore::compare_filename(int shape_id, const std::string &filename) const {
+	const uint64_t length = filename_offsets[shape_id + 1] - filename_offsets[shape_id];
+	const int order = std::memcmp(filename_characters + filename_offsets[shape_id], filename.data(),
+	                              std::min<uint64_t>(length, filename.size()));
+
+	// Ordered as std::string orders them, so a prefix comes first
+	if (order != 0)
+		return order;
+
+	return length < filename.size() ? -1 : (length > filename.size() ? 1 : 0);
+}
+
+const double *FeatureStore::global_descriptor(GlobalDescriptor global_descriptor) const {
+	return global_descriptors[global_descriptor];
+}
+
+const double *FeatureStore::property_descriptor(PropertyDescriptor property_descriptor) const {
+	return property_descriptors[property_descriptor];
+}
+
+const double *FeatureStore::histogram(PropertyDescriptor property_descriptor, int shape_id) const {
+	return property_descriptors[property_descriptor] + shape_id * HISTOGRAM_BAR_COUNT;
+}
+
+const double *FeatureStore::sorted_histogram(PropertyDescriptor property_descriptor, int shape_id) const {
+	return sorted_property_descriptors[property_descriptor] + shape_id * HISTOGRAM_BAR_COUNT;
+}
+
+FeatureVector FeatureStore::feature_vector(int shape_id) const {
+	FeatureVector features{};
+
+	for (int i = 0; i < GLOBAL_DESCRIPTOR_COUNT; i++)
+		features.values[i] = global_descriptors[i][shape_id];
+
+	for (int i = 0; i < PROPERTY_DESCRIPTOR_COUNT; i++) {
+		const double *shape_histogram = histogram((PropertyDescriptor) i, shape_id);
+		std::copy(shape_histogram, shape_histogram + HISTOGRAM_BAR_COUNT,
+		          features.values + GLOBAL_DESCRIPTOR_COUNT + i * HISTOGRAM_BAR_COUNT);
+	}
+
+	return features;
+}
+
+const FeatureQuantization &FeatureStore::quantization() const {
+	return *feature_quantization;
+}
+
+const uint8_t *FeatureStore::feature_codes(int shape_id) const {
+	return codes + (size_t) shape_id * FEATURE_CODE_STRIDE;
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+#include "config.h"
+#include "database_mr.h"
+#include "feature_extraction.h"
+
+class AnnIndex;
+
+class HnswIndex;
+
+class IvfIndex;
+
+class PqIndex;
+
+// All normalized features of one shape, in the order: global descriptors, then the A3, D1, D2, D3 and D4 histograms
+struct FeatureVector {
+	double values[FEATURE_VECTOR_DIMENSION];
+};
+
+// Per-dimension 8-bit scalar quantization of sorted feature vectors, spanning the range of the values in the store.
+// A value v is coded as round((v - minimum) / step) and decodes to minimum + code * step.
+struct FeatureQuantization {
+	double minimum[FEATURE_VECTOR_DIMENSION];
+	double step[FEATURE_VECTOR_DIMENSION];
+};
+
+// Start of a feature snapshot file. Everything after it is laid out as described in feature_store.cpp.
+struct FeatureSnapshotHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t dimension;
+	uint64_t shape_count;
+	int64_t generation; // DatabaseMetadata::generation the snapshot was taken at
+	uint64_t statistics_checksum; // Of the DatabaseStatistics the global descriptors were normalized with
+	uint64_t size; // Of the whole file, header included
+	uint64_t payload_checksum;
+	uint64_t header_checksum; // Of all fields above
+};
+
+// Column-oriented copy of the normalized shapes table, used by feature matching.
+// Every descriptor lives in its own contiguous array, indexed by shape id (0 to size() - 1).
+// The store is either built in memory or memory-mapped from a snapshot file next to the database.
+class FeatureStore {
+public:
+	static FeatureStore from_shapes(const std::vector<DatabaseShape> &normalized_shapes, int generation,
+	                                const DatabaseStatistics &statistics);
+
+	// Maps the snapshot of the database, regenerating it first if it is missing or out of date.
+	// Also loads the database's ANN, HNSW, PQ and IVF indexes if there are, rebuilding the ANN and PQ indexes if they
+	// are out of date and inserting shapes added since the HNSW graph or IVF index was stored.
+	// What is regenerated is written back next to the database, unless the database was opened read-only.
+	static FeatureStore load(const Database &database, bool print);
+
+	// As above, but normalized with the given statistics instead of the database's own (used for shards)
+	static FeatureStore load(const Database &database, const DatabaseStatistics &statistics, bool print);
+
+	static boost::filesystem::path snapshot_path(const boost::filesystem::path &database_path);
+
+	// What statistics_checksum() is for a store normalized with these statistics
+	static uint64_t checksum(const DatabaseStatistics &statistics);
+
+	static FeatureVector feature_vector(const DatabaseShape &normalized_shape);
+
+	// As feature_vector(), with the bars of every histogram in ascending order
+	static FeatureVector sorted_feature_vector(const DatabaseShape &normalized_shape);
+
+	static FeatureVector sorted_feature_vector(const FeatureVector &features);
+
+	bool save(const boost::filesystem::path &path) const;
+
+	// Verifies the payload checksum, which touches every page of the snapshot
+	bool verify() const;
+
+	// Verifies the snapshot mapped from path the first time it is mapped, and if keep_record is set records that it did
+	// next to it, so the maps that follow do not touch every page
+	bool verify_once(const boost::filesystem::path &path, bool keep_record) const;
+
+	int size() const;
+
+	int generation() const;
+
+	uint64_t statistics_checksum() const;
+
+	// nullptr if the database has no ANN index
+	const AnnIndex *ann_index() const;
+
+	// nullptr if the database has no HNSW graph
+	const HnswIndex *hnsw_index() const;
+
+	// nullptr if the database has no PQ index
+	const PqIndex *pq_index() const;
+
+	// nullptr if the database has no IVF index
+	const IvfIndex *ivf_index() const;
+
+	// Builds the ANN, HNSW, PQ or IVF index the method searches in memory, unless the store has one weighted for this
+	// metadata, so that many queries share one instead of building one each
+	void build_index_if_needed(const DatabaseMetadata &metadata, Util::FeatureMatchingMethod method);
+
+	std::string filename(int shape_id) const;
+
+	// Returns -1 if no shape with this filename is in the store
+	int shape_id(const std::string &filename) const;
+
+	// size() values
+	const double *global_descriptor(GlobalDescriptor global_descriptor) const;
+
+	// size() * HISTOGRAM_BAR_COUNT values, one histogram per shape
+	const double *property_descriptor(PropertyDescriptor property_descriptor) const;
+
+	const double *histogram(PropertyDescriptor property_descriptor, int shape_id) const;
+
+	// The histogram with its bars in ascending order, as the EMD needs them
+	const double *sorted_histogram(PropertyDescriptor property_descriptor, int shape_id) const;
+
+	FeatureVector feature_vector(int shape_id) const;
+
+	const FeatureQuantization &quantization() const;
+
+	// The codes of the sorted feature vector of the shape, padded with zeros to FEATURE_CODE_STRIDE bytes
+	const uint8_t *feature_codes(int shape_id) const;
+
+private:
+	std::shared_ptr<const void> storage; // Owned buffer or file mapping the pointers below point into
+	const FeatureSnapshotHeader *header = nullptr;
+	const double *global_descriptors[GLOBAL_DESCRIPTOR_COUNT] = {};
+	const double *property_descriptors[PROPERTY_DESCRIPTOR_COUNT] = {};
+	const double *sorted_property_descriptors[PROPERTY_DESCRIPTOR_COUNT] = {};
+	const FeatureQuantization *feature_quantization = nullptr;
+	const uint8_t *codes = nullptr;
+	const uint64_t *filename_offsets = nullptr;
+	const int32_t *sorted_shape_ids = nullptr; // In filename order
+	const char *filename_characters = nullptr;
+	std::shared_ptr<const AnnIndex> index;
+	std::shared_ptr<const HnswIndex> graph;
+	std::shared_ptr<const PqIndex> product_quantizer;
+	std::shared_ptr<const IvfIndex> inverted_file;
+
+	static FeatureStore load_snapshot(const Database &database, const DatabaseStatistics &statistics, bool print);
+
+	// Each of these writes an index it had to rebuild or update back to its file if persist is set
+
+	void load_ann_index(const boost::filesystem::path &database_path, const DatabaseMetadata &metadata, bool persist,
+	                    bool print);
+
+	void load_hnsw_index(const boost::filesystem::path &database_path, const DatabaseMetadata &metadata, bool persist,
+	                     bool print);
+
+	void load_pq_index(const boost::filesystem::path &database_path, bool persist, bool print);
+
+	void load_ivf_index(const boost::filesystem::path &database_path, const DatabaseMetadata &metadata, bool persist,
+	                    bool print);
+
+	static FeatureStore map(const boost::filesystem::path &path);
+
+	static bool is_valid_header(const FeatureSnapshotHeader &header, uint64_t size);
+
+	void set_pointers(const char *image);
+
+	// What the record next to the snapshot at path holds once the snapshot is verified; empty if path cannot be read
+	std::string verification_record(const boost::filesystem::path &path) const;
+
+	void record_verified(const boost::filesystem::path &path) const;
+
+	// Negative, zero or positive as the filename of the shape orders before, equal to or after this filename
+	int compare_filename(int shape_id, const std::string &filename) const;
+};
@@ -0,0 +1,386 @@
+#include "hnsw_index.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <queue>
+#include <random>
+#include <sstream>
+#include "config.h"
+
+/*
+ * Index file layout: one header line
+ *     MRHNSW <version> <dimension> <shape count> <generation> <statistics checksum> <scales checksum>
+ *            <filenames checksum> <m> <ef construction> <entry point> <top level> <graph checksum>
+ * followed by the graph: for every node its level count, then for every level its link count and links,
+ * all as 32-bit integers. Coordinates are not stored; they are taken from the feature store on load.
+ */
+
+static const std::string HNSW_INDEX_MAGIC = "MRHNSW";
+static const int HNSW_INDEX_VERSION = 1;
+
+static const int HNSW_MAXIMUM_LEVEL = 16;
+static const uint32_t HNSW_LEVEL_SEED = 0x9e3779b9;
+
+// The settings an index is built with, as it uses them
+static int hnsw_m(const DatabaseMetadata &metadata) {
+	return std::max(2, metadata.hnsw_m);
+}
+
+static int hnsw_ef_construction(const DatabaseMetadata &metadata) {
+	return std::max(hnsw_m(metadata), metadata.hnsw_ef_construction);
+}
+
+static void write_int(std::string &out, int32_t value) {
+	out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+static bool read_int(const std::string &in, size_t &offset, int32_t &value) {
+	if (offset + sizeof(value) > in.size())
+		return false;
+
+	std::memcpy(&value, in.data() + offset, sizeof(value));
+	offset += sizeof(value);
+	return true;
+}
+
+std::shared_ptr<HnswIndex> HnswIndex::build(const FeatureStore &store, const DatabaseMetadata &metadata) {
+	std::shared_ptr<HnswIndex> index(new HnswIndex());
+	index->m = hnsw_m(metadata);
+	index->ef_construction = hnsw_ef_construction(metadata);
+	index->scales = FeatureMatching::dimension_scales(metadata);
+
+	index->insert_new_shapes(store);
+	return index;
+}
+
+std::shared_ptr<HnswIndex> HnswIndex::load(const boost::filesystem::path &path, const FeatureStore &store,
+                                           const DatabaseMetadata &metadata) {
+	std::ifstream file(path.string(), std::ios::binary);
+
+	if (!file)
+		return nullptr;
+
+	std::string header_line;
+	std::getline(file, header_line);
+
+	std::istringstream header(header_line);
+	std::string magic;
+	int version = 0;
+	int dimension = 0;
+	int shape_count = 0;
+	uint64_t scales_checksum = 0;
+	uint64_t graph_checksum = 0;
+
+	std::shared_ptr<HnswIndex> index(new HnswIndex());
+	index->scales = FeatureMatching::dimension_scales(metadata);
+
+	header >> magic >> version >> dimension >> shape_count >> index->generation >> index->statistics_checksum
+	       >> scales_checksum >> index->filenames_checksum >> index->m >> index->ef_construction
+	       >> index->entry_point >> index->top_level >> graph_checksum;
+
+	if (header.fail() || magic != HNSW_INDEX_MAGIC || version != HNSW_INDEX_VERSION
+	    || dimension != FEATURE_VECTOR_DIMENSION || scales_checksum != FeatureMatching::checksum(index->scales)
+	    || index->m != hnsw_m(metadata) || index->ef_construction != hnsw_ef_construction(metadata)
+	    || shape_count > store.size() || index->filenames_checksum != checksum_filenames(store, shape_count)
+	    || index->entry_point >= shape_count || index->top_level >= HNSW_MAXIMUM_LEVEL)
+		return nullptr;
+
+	const std::string graph((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+	if (Util::hash(graph.data(), graph.size()) != graph_checksum)
+		return nullptr;
+
+	index->links.resize(shape_count);
+	size_t offset = 0;
+
+	for (std::vector<std::vector<int>> &node_links : index->links) {
+		int32_t level_count = 0;
+
+		if (!read_int(graph, offset, level_count) || level_count < 1 || level_count > HNSW_MAXIMUM_LEVEL + 1)
+			return nullptr;
+
+		node_links.resize(level_count);
+
+		for (std::vector<int> &level_links : node_links) {
+			int32_t link_count = 0;
+
+			if (!read_int(graph, offset, link_count) || link_count < 0)
+				return nullptr;
+
+			level_links.resize(link_count);
+
+			for (int &link : level_links) {
+				int32_t node = 0;
+
+				if (!read_int(graph, offset, node) || node < 0 || node >= shape_count)
+					return nullptr;
+
+				link = node;
+			}
+		}
+	}
+
+	index->fill_coordinates(store);
+	return index;
+}
+
+boost::filesystem::path HnswIndex::index_path(const boost::filesystem::path &database_path) {
+	return database_path.string() + ".hnsw";
+}
+
+bool HnswIndex::save(const boost::filesystem::path &path) const {
+	std::string graph;
+
+	for (const std::vector<std::vector<int>> &node_links : links) {
+		write_int(graph, node_links.size());
+
+		for (const std::vector<int> &level_links : node_links) {
+			write_int(graph, level_links.size());
+
+			for (int link : level_links)
+				write_int(graph, link);
+		}
+	}
+
+	return Util::write_file_atomically(path, [&](std::ostream &file) {
+		file << HNSW_INDEX_MAGIC << " " << HNSW_INDEX_VERSION << " " << FEATURE_VECTOR_DIMENSION << " " << size()
+		     << " " << generation << " " << statistics_checksum << " " << FeatureMatching::checksum(scales)
+		     << " " << filenames_checksum << " " << m << " " << ef_construction << " " << entry_point
+		     << " " << top_level << " " << Util::hash(graph.data(), graph.size()) << "\n" << graph;
+	});
+}
+
+bool HnswIndex::matches(const FeatureStore &store) const {
+	return size() == store.size()
+	       && generation == store.generation()
+	       && statistics_checksum == store.statistics_checksum();
+}
+
+bool HnswIndex::is_weighted_for(const DatabaseMetadata &metadata) const {
+	return scales == FeatureMatching::dimension_scales(metadata);
+}
+
+int HnswIndex::size() const {
+	return links.size();
+}
+
+void HnswIndex::insert_new_shapes(const FeatureStore &store) {
+	// Every shape is normalized anew whenever one is added, so the coordinates of the old ones are refreshed too
+	fill_coordinates(store);
+
+	const int first_new_node = size();
+	links.resize(store.size());
+
+	for (int node = first_new_node; node < store.size(); node++)
+		insert(node);
+
+	generation = store.generation();
+	statistics_checksum = store.statistics_checksum();
+	filenames_checksum = checksum_filenames(store, store.size());
+}
+
+std::vector<ShapeMatch>
+HnswIndex::search(const FeatureVector &query, int query_shape_id, const DatabaseMetadata &metadata) const {
+	std::vector<ShapeMatch> similar_shapes;
+
+	// One candidate more is kept when the query is in the graph, as the search finds the query itself too
+	const bool query_in_graph = query_shape_id >= 0 && query_shape_id < size();
+	const int k = std::min(metadata.maximum_returned_matches, size() - (int) query_in_graph);
+
+	if (k <= 0)
+		return similar_shapes;
+
+	double target[FEATURE_VECTOR_DIMENSION];
+	FeatureMatching::scaled_features(query, scales, target);
+
+	int entry = entry_point;
+
+	for (int level = top_level; level > 0; level--)
+		entry = search_level(target, entry, 1, level)[0].second;
+
+	// Distances are squared STD distances, as in AnnIndex
+	const int ef = std::max(metadata.hnsw_ef_search, k + (int) query_in_graph);
+
+	for (const Candidate &candidate : search_level(target, entry, ef, 0)) {
+		if (similar_shapes.size() == k)
+			break;
+
+		if (candidate.second != query_shape_id)
+			similar_shapes.push_back({candidate.second, std::sqrt(candidate.first)});
+	}
+
+	return similar_shapes;
+}
+
+uint64_t HnswIndex::checksum_filenames(const FeatureStore &store, int shape_count) {
+	uint64_t checksum = Util::hash(nullptr, 0);
+
+	for (int shape_id = 0; shape_id < shape_count; shape_id++) {
+		const std::string filename = store.filename(shape_id);
+		checksum = Util::hash(filename.c_str(), filename.size() + 1, checksum); // Terminator included as separator
+	}
+
+	return checksum;
+}
+
+int HnswIndex::random_level(int node) const {
+	std::mt19937 generator(HNSW_LEVEL_SEED ^ (uint32_t) node);
+	std::uniform_real_distribution<double> distribution(0.0, 1.0);
+
+	// Each level holds about 1/m of the nodes of the level below
+	const double level = -std::log(1.0 - distribution(generator)) / std::log((double) m);
+	return std::min((int) level, HNSW_MAXIMUM_LEVEL - 1);
+}
+
+void HnswIndex::fill_coordinates(const FeatureStore &store) {
+	coordinates.assign((size_t) store.size() * FEATURE_VECTOR_STRIDE, 0.0);
+
+	for (int shape_id = 0; shape_id < store.size(); shape_id++)
+		FeatureMatching::scaled_features(store, shape_id, scales,
+		                                 coordinates.data() + (size_t) shape_id * FEATURE_VECTOR_STRIDE);
+}
+
+const double *HnswIndex::point(int node) const {
+	return coordinates.data() + (size_t) node * FEATURE_VECTOR_STRIDE;
+}
+
+double HnswIndex::distance(const double *a, const double *b) {
+	double distance = 0;
+
+	for (int i = 0; i < FEATURE_VECTOR_DIMENSION; i++)
+		distance += std::abs(a[i] - b[i]);
+
+	return distance;
+}
+
+void HnswIndex::insert(int node) {
+	const int level = random_level(node);
+	links[node].assign(level + 1, std::vector<int>());
+
+	if (entry_point < 0) {
+		entry_point = node;
+		top_level = level;
+		return;
+	}
+
+	const double *target = point(node);
+	int entry = entry_point;
+
+	for (int l = top_level; l > level; l--)
+		entry = search_level(target, entry, 1, l)[0].second;
+
+	for (int l = std::min(level, top_level); l >= 0; l--) {
+		const std::vector<Candidate> candidates = search_level(target, entry, ef_construction, l);
+		links[node][l] = select_neighbors(candidates, m);
+
+		for (int neighbor : links[node][l]) {
+			std::vector<int> &neighbor_links = links[neighbor][l];
+			neighbor_links.push_back(node);
+
+			if (neighbor_links.size() <= maximum_links(l))
+				continue;
+
+			std::vector<Candidate> neighbor_candidates;
+
+			for (int link : neighbor_links)
+				neighbor_candidates.emplace_back(distance(point(neighbor), point(link)), link);
+
+			std::sort(neighbor_candidates.begin(), neighbor_candidates.end());
+			neighbor_links = select_neighbors(neighbor_candidates, maximum_links(l));
+		}
+
+		entry = candidates[0].second;
+	}
+
+	if (level > top_level) {
+		entry_point = node;
+		top_level = level;
+	}
+}
+
+std::vector<HnswIndex::Candidate>
+HnswIndex::search_level(const double *target, int entry, int ef, int level) const {
+	// A node is visited when its mark is the current tag; the marks are reused by every search of the thread
+	thread_local std::vector<unsigned int> visit_marks;
+	thread_local unsigned int visit_tag = 0;
+
+	if (visit_marks.size() < links.size())
+		visit_marks.resize(links.size(), 0);
+
+	if (++visit_tag == 0) {
+		std::fill(visit_marks.begin(), visit_marks.end(), 0);
+		visit_tag = 1;
+	}
+
+	std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> candidates; // Nearest on top
+	std::priority_queue<Candidate> nearest; // Furthest on top
+
+	const double entry_distance = distance(target, point(entry));
+	candidates.emplace(entry_distance, entry);
+	nearest.emplace(entry_distance, entry);
+	visit_marks[entry] = visit_tag;
+
+	while (!candidates.empty()) {
+		const Candidate candidate = candidates.top();
+
+		// Every candidate left is further away than all ef nearest nodes found
+		if (candidate.first > nearest.top().first && nearest.size() >= ef)
+			break;
+
+		candidates.pop();
+
+		for (int neighbor : links[candidate.second][level]) {
+			if (visit_marks[neighbor] == visit_tag)
+				continue;
+
+			visit_marks[neighbor] = visit_tag;
+			const double neighbor_distance = distance(target, point(neighbor));
+
+			if (nearest.size() < ef || neighbor_distance < nearest.top().first) {
+				candidates.emplace(neighbor_distance, neighbor);
+				nearest.emplace(neighbor_distance, neighbor);
+
+				if (nearest.size() > ef)
+					nearest.pop();
+			}
+		}
+	}
+
+	std::vector<Candidate> nearest_first(nearest.size());
+
+	for (int i = nearest.size() - 1; i >= 0; i--) {
+		nearest_first[i] = nearest.top();
+		nearest.pop();
+	}
+
+	return nearest_first;
+}
+
+std::vector<int> HnswIndex::select_neighbors(const std::vector<Candidate> &candidates, int count) const {
+	std::vector<int> selected;
+
+	for (const Candidate &candidate : candidates) {
+		if (selected.size() == count)
+			break;
+
+		bool is_diverse = true;
+
+		for (int neighbor : selected) {
+			if (distance(point(candidate.second), point(neighbor)) < candidate.first) {
+				is_diverse = false;
+				break;
+			}
+		}
+
+		if (is_diverse)
+			selected.push_back(candidate.second);
+	}
+
+	return selected;
+}
+
+int HnswIndex::maximum_links(int level) const {
+	return level == 0 ? 2 * m : m;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <boost/align/aligned_allocator.hpp>
+#include <boost/filesystem.hpp>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "database_mr.h"
+#include "feature_matching.h"
+#include "feature_store.h"
+#include "top_k.h"
+#include "util.h"
+
+// Hierarchical navigable small world graph (Malkov and Yashunin) over the feature vectors of a feature store, used by
+// HNSW matching. Coordinates are scaled as FeatureMatching::scaled_features() does, so the distances it returns are
+// STD distances; only which shapes it finds is approximate.
+// Unlike AnnIndex it keeps no global state, so any number of searches may run at once.
+// --build-index persists it next to the database. Shapes added after that are inserted into the stored graph the next
+// time the store is loaded; a change of weights, hnsw_m or hnsw_ef_construction rebuilds it.
+class HnswIndex {
+public:
+	HnswIndex(const HnswIndex &) = delete;
+
+	HnswIndex &operator=(const HnswIndex &) = delete;
+
+	static std::shared_ptr<HnswIndex> build(const FeatureStore &store, const DatabaseMetadata &metadata);
+
+	// Returns nullptr if there is no index file, if it was built with other settings, or if the shapes it holds are not
+	// the first shapes of the store. Shapes the store holds beyond those still have to be inserted.
+	static std::shared_ptr<HnswIndex> load(const boost::filesystem::path &path, const FeatureStore &store,
+	                                       const DatabaseMetadata &metadata);
+
+	static boost::filesystem::path index_path(const boost::filesystem::path &database_path);
+
+	bool save(const boost::filesystem::path &path) const;
+
+	// Whether the graph holds every shape of the store, normalized as the store is
+	bool matches(const FeatureStore &store) const;
+
+	bool is_weighted_for(const DatabaseMetadata &metadata) const;
+
+	int size() const;
+
+	// Inserts the shapes of the store the graph does not hold yet, and takes over the normalization of the store
+	void insert_new_shapes(const FeatureStore &store);
+
+	// The maximum_returned_matches nearest shapes the graph finds with a candidate list of hnsw_ef_search entries,
+	// other than the query shape (-1 if the query is not in the store)
+	std::vector<ShapeMatch>
+	search(const FeatureVector &query, int query_shape_id, const DatabaseMetadata &metadata) const;
+
+private:
+	typedef std::pair<double, int> Candidate; // Distance to the point searched for, and node
+
+	// One row of FEATURE_VECTOR_STRIDE coordinates per node (which is the shape id), as in AnnIndex
+	std::vector<double, boost::alignment::aligned_allocator<double, FEATURE_STORE_ALIGNMENT>> coordinates;
+
+	// links[node][level] holds the neighbors of node on that level; a node is on every level up to its own
+	std::vector<std::vector<std::vector<int>>> links;
+	int entry_point = -1;
+	int top_level = -1;
+
+	int m = 0;
+	int ef_construction = 0;
+
+	// What the graph was built from
+	int64_t generation = 0;
+	uint64_t statistics_checksum = 0;
+	uint64_t filenames_checksum = 0; // Of the filenames of the shapes in the graph, in shape id order
+	DimensionScales scales{};
+
+	HnswIndex() = default;
+
+	static uint64_t checksum_filenames(const FeatureStore &store, int shape_count);
+
+	// Level a node is inserted up to; drawn from a generator seeded with the node, so a graph does not depend on how
+	// many of its shapes were inserted incrementally
+	int random_level(int node) const;
+
+	// Copies the scaled feature vectors of the store into coordinates
+	void fill_coordinates(const FeatureStore &store);
+
+	const double *point(int node) const;
+
+	static double distance(const double *a, const double *b);
+
+	void insert(int node);
+
+	// The ef nearest nodes on level the search from entry reaches, nearest first
+	std::vector<Candidate> search_level(const double *target, int entry, int ef, int level) const;
+
+	// Picks up to count of candidates (nearest first), skipping those nearer to an already picked one than to the
+	// target, so that links spread out in every direction
+	std::vector<int> select_neighbors(const std::vector<Candidate> &candidates, int count) const;
+
+	int maximum_links(int level) const;
+};
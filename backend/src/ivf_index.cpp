@@ -0,0 +1,298 @@
+#include "ivf_index.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <utility>
+#include "config.h"
+
+/*
+ * Index file layout: one header line
+ *     MRIVF <version> <dimension> <shape count> <trained shape count> <generation> <statistics checksum>
+ *           <scales checksum> <filenames checksum> <list count> <payload checksum>
+ * followed by the payload: the centroids as doubles, in the order of IvfIndex::centroids, then the list of every shape
+ * in shape id order, as 32-bit integers.
+ */
+
+static const std::string IVF_INDEX_MAGIC = "MRIVF";
+static const int IVF_INDEX_VERSION = 3;
+
+static const int IVF_TRAINING_SAMPLES_PER_LIST = 32;
+static const int IVF_TRAINING_ITERATIONS = 10;
+static const unsigned int IVF_TRAINING_SEED = 1;
+static const int IVF_RETRAINING_GROWTH = 2;
+
+// The list count an index is built with: ivf_list_count, or about the square root of the shape count if that is 0
+static int ivf_list_count(const DatabaseMetadata &metadata, int shape_count) {
+	const int list_count = metadata.ivf_list_count > 0 ? metadata.ivf_list_count
+	                                                   : (int) std::lround(std::sqrt((double) shape_count));
+	return std::max(1, std::min(list_count, shape_count));
+}
+
+std::shared_ptr<IvfIndex> IvfIndex::build(const FeatureStore &store, const DatabaseMetadata &metadata) {
+	std::shared_ptr<IvfIndex> index(new IvfIndex());
+	index->scales = FeatureMatching::dimension_scales(metadata);
+
+	index->train(store, ivf_list_count(metadata, store.size()));
+	index->insert_new_shapes(store);
+	return index;
+}
+
+std::shared_ptr<IvfIndex> IvfIndex::load(const boost::filesystem::path &path, const FeatureStore &store,
+                                         const DatabaseMetadata &metadata) {
+	std::ifstream file(path.string(), std::ios::binary);
+
+	if (!file)
+		return nullptr;
+
+	std::string header_line;
+	std::getline(file, header_line);
+
+	std::istringstream header(header_line);
+	std::string magic;
+	int version = 0;
+	int dimension = 0;
+	uint64_t scales_checksum = 0;
+	int stored_list_count = 0;
+	uint64_t payload_checksum = 0;
+
+	std::shared_ptr<IvfIndex> index(new IvfIndex());
+	index->scales = FeatureMatching::dimension_scales(metadata);
+
+	header >> magic >> version >> dimension >> index->shape_count >> index->trained_shape_count >> index->generation
+	       >> index->statistics_checksum >> scales_checksum >> index->filenames_checksum >> stored_list_count
+	       >> payload_checksum;
+
+	// A list count left to the index is kept as the store grows, until the index is rebuilt
+	if (header.fail() || magic != IVF_INDEX_MAGIC || version != IVF_INDEX_VERSION
+	    || dimension != FEATURE_VECTOR_DIMENSION || scales_checksum != FeatureMatching::checksum(index->scales)
+	    || stored_list_count < 1 || (metadata.ivf_list_count > 0 && stored_list_count != metadata.ivf_list_count)
+	    || index->shape_count < 0 || index->shape_count > store.size() || index->trained_shape_count < 0
+	    || index->filenames_checksum != checksum_filenames(store, index->shape_count))
+		return nullptr;
+
+	const std::string payload((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	const size_t centroids_size = (size_t) stored_list_count * FEATURE_VECTOR_DIMENSION * sizeof(double);
+
+	if (payload.size() != centroids_size + (size_t) index->shape_count * sizeof(int32_t)
+	    || Util::hash(payload.data(), payload.size()) != payload_checksum)
+		return nullptr;
+
+	index->centroids.resize((size_t) stored_list_count * FEATURE_VECTOR_DIMENSION);
+	std::memcpy(index->centroids.data(), payload.data(), centroids_size);
+	index->lists.resize(stored_list_count);
+
+	for (int shape_id = 0; shape_id < index->shape_count; shape_id++) {
+		int32_t list = 0;
+		std::memcpy(&list, payload.data() + centroids_size + shape_id * sizeof(int32_t), sizeof(list));
+
+		if (list < 0 || list >= stored_list_count)
+			return nullptr;
+
+		index->lists[list].push_back(shape_id);
+	}
+
+	return index;
+}
+
+boost::filesystem::path IvfIndex::index_path(const boost::filesystem::path &database_path) {
+	return database_path.string() + ".ivf";
+}
+
+bool IvfIndex::save(const boost::filesystem::path &path) const {
+	std::vector<int32_t> shape_lists(shape_count);
+
+	for (int list = 0; list < list_count(); list++) {
+		for (int shape_id : lists[list])
+			shape_lists[shape_id] = list;
+	}
+
+	std::string payload(reinterpret_cast<const char *>(centroids.data()), centroids.size() * sizeof(double));
+	payload.append(reinterpret_cast<const char *>(shape_lists.data()), shape_lists.size() * sizeof(int32_t));
+
+	return Util::write_file_atomically(path, [&](std::ostream &file) {
+		file << IVF_INDEX_MAGIC << " " << IVF_INDEX_VERSION << " " << FEATURE_VECTOR_DIMENSION << " " << size()
+		     << " " << trained_shape_count << " " << generation << " " << statistics_checksum
+		     << " " << FeatureMatching::checksum(scales)
+		     << " " << filenames_checksum << " " << list_count() << " " << Util::hash(payload.data(), payload.size())
+		     << "\n" << payload;
+	});
+}
+
+bool IvfIndex::matches(const FeatureStore &store) const {
+	return size() == store.size()
+	       && generation == store.generation()
+	       && is_normalized_as(store);
+}
+
+bool IvfIndex::is_weighted_for(const DatabaseMetadata &metadata) const {
+	return scales == FeatureMatching::dimension_scales(metadata);
+}
+
+int IvfIndex::size() const {
+	return shape_count;
+}
+
+int IvfIndex::list_count() const {
+	return lists.size();
+}
+
+int IvfIndex::trained_size() const {
+	return trained_shape_count;
+}
+
+bool IvfIndex::is_normalized_as(const FeatureStore &store) const {
+	return statistics_checksum == store.statistics_checksum();
+}
+
+bool IvfIndex::needs_retraining(const FeatureStore &store) const {
+	return (long long) store.size() >= (long long) IVF_RETRAINING_GROWTH * std::max(1, trained_shape_count);
+}
+
+void IvfIndex::insert_new_shapes(const FeatureStore &store) {
+	// Under other statistics every shape has other coordinates, and may have another nearest centroid
+	if (!is_normalized_as(store)) {
+		lists.assign(list_count(), std::vector<int>());
+		shape_count = 0;
+	}
+
+	assign(store, shape_count);
+
+	shape_count = store.size();
+	generation = store.generation();
+	statistics_checksum = store.statistics_checksum();
+	filenames_checksum = checksum_filenames(store, store.size());
+}
+
+std::vector<int> IvfIndex::search(const FeatureVector &query, const DatabaseMetadata &metadata) const {
+	double point[FEATURE_VECTOR_DIMENSION];
+	FeatureMatching::scaled_features(query, scales, point);
+
+	std::vector<std::pair<double, int>> nearest_lists(list_count());
+
+	for (int list = 0; list < list_count(); list++)
+		nearest_lists[list] = {distance(point, centroid(list)), list};
+
+	// At least one list is probed
+	const int probe_count = std::min(std::max(1, metadata.ivf_probe_count), list_count());
+	std::partial_sort(nearest_lists.begin(), nearest_lists.begin() + probe_count, nearest_lists.end());
+
+	std::vector<int> shape_ids;
+
+	for (int i = 0; i < probe_count; i++) {
+		const std::vector<int> &list = lists[nearest_lists[i].second];
+		shape_ids.insert(shape_ids.end(), list.begin(), list.end());
+	}
+
+	return shape_ids;
+}
+
+uint64_t IvfIndex::checksum_filenames(const FeatureStore &store, int shape_count) {
+	uint64_t checksum = Util::hash(nullptr, 0);
+
+	for (int shape_id = 0; shape_id < shape_count; shape_id++) {
+		const std::string filename = store.filename(shape_id);
+		checksum = Util::hash(filename.c_str(), filename.size() + 1, checksum); // Terminator included as separator
+	}
+
+	return checksum;
+}
+
+const double *IvfIndex::centroid(int list) const {
+	return centroids.data() + (size_t) list * FEATURE_VECTOR_DIMENSION;
+}
+
+double IvfIndex::distance(const double *a, const double *b) {
+	double distance = 0;
+
+	for (int i = 0; i < FEATURE_VECTOR_DIMENSION; i++)
+		distance += std::abs(a[i] - b[i]);
+
+	return distance;
+}
+
+int IvfIndex::nearest_centroid(const double *point) const {
+	int nearest = 0;
+	double nearest_distance = INFINITY;
+
+	for (int list = 0; list < list_count(); list++) {
+		const double list_distance = distance(point, centroid(list));
+
+		if (list_distance < nearest_distance) {
+			nearest = list;
+			nearest_distance = list_distance;
+		}
+	}
+
+	return nearest;
+}
+
+void IvfIndex::train(const FeatureStore &store, int list_count) {
+	const int sample_count = std::min(store.size(), IVF_TRAINING_SAMPLES_PER_LIST * list_count);
+
+	// Every shape if there are few, otherwise shapes spread evenly over the store
+	std::vector<double> samples((size_t) sample_count * FEATURE_VECTOR_DIMENSION);
+
+	for (int i = 0; i < sample_count; i++)
+		FeatureMatching::scaled_features(store, (int) ((long long) i * store.size() / sample_count), scales,
+		                                 samples.data() + (size_t) i * FEATURE_VECTOR_DIMENSION);
+
+	centroids.assign((size_t) list_count * FEATURE_VECTOR_DIMENSION, 0.0);
+	lists.assign(list_count, std::vector<int>());
+	trained_shape_count = store.size();
+
+	if (sample_count == 0)
+		return;
+
+	// Centroids start at samples drawn from a fixed seed, so a build is reproducible
+	std::vector<int> order(sample_count);
+	std::iota(order.begin(), order.end(), 0);
+	std::shuffle(order.begin(), order.end(), std::mt19937(IVF_TRAINING_SEED));
+
+	for (int list = 0; list < list_count; list++) {
+		const double *sample = samples.data() + (size_t) order[list % sample_count] * FEATURE_VECTOR_DIMENSION;
+		std::copy(sample, sample + FEATURE_VECTOR_DIMENSION,
+		          centroids.begin() + (size_t) list * FEATURE_VECTOR_DIMENSION);
+	}
+
+	std::vector<int> assignments(sample_count, -1);
+
+	for (int iteration = 0; iteration < IVF_TRAINING_ITERATIONS; iteration++) {
+		std::vector<char> changed(sample_count, false);
+
+		Util::parallel_for(sample_count, [&](int first, int last) {
+			for (int i = first; i < last; i++) {
+				const int nearest = nearest_centroid(samples.data() + (size_t) i * FEATURE_VECTOR_DIMENSION);
+				changed[i] = nearest != assignments[i];
+				assignments[i] = nearest;
+			}
+		});
+
+		if (std::find(changed.begin(), changed.end(), true) == changed.end())
+			break;
+
+		// The median, not the mean, is the centre of the samples under the L1 distance they are assigned by
+		Util::move_centroids_to_medians(samples, FEATURE_VECTOR_DIMENSION, 0, FEATURE_VECTOR_DIMENSION, assignments,
+		                                list_count, centroids.data());
+	}
+}
+
+void IvfIndex::assign(const FeatureStore &store, int first_shape_id) {
+	std::vector<int> nearest_lists(std::max(0, store.size() - first_shape_id));
+
+	Util::parallel_for(nearest_lists.size(), [&](int first, int last) {
+		double point[FEATURE_VECTOR_DIMENSION];
+
+		for (int i = first; i < last; i++) {
+			FeatureMatching::scaled_features(store, first_shape_id + i, scales, point);
+			nearest_lists[i] = nearest_centroid(point);
+		}
+	});
+
+	// Appended in shape id order, so every list stays sorted
+	for (int i = 0; i < nearest_lists.size(); i++)
+		lists[nearest_lists[i]].push_back(first_shape_id + i);
+}
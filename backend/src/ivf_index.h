@@ -0,0 +1,94 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+#include "database_mr.h"
+#include "feature_matching.h"
+#include "feature_store.h"
+#include "util.h"
+
+// Inverted file (Sivic and Zisserman) over the feature vectors of a feature store, used by IVF matching.
+// A k-medians coarse quantizer splits the shapes into ivf_list_count posting lists, each holding the ids of the shapes
+// nearest to its centroid. A search ranks only the shapes in the ivf_probe_count lists nearest to the query, by their
+// exact STD distance, so it reads a fraction of the store; the index itself holds little more than one id per shape.
+// Coordinates are scaled as FeatureMatching::scaled_features() does, so the distance to a centroid is a squared STD
+// distance. --build-index persists it next to the database. Shapes added after that are put in the list of their
+// nearest centroid the next time the store is loaded, without retraining; a change of weights or ivf_list_count
+// retrains it. Every added shape also changes the statistics the global descriptors are normalized with, which moves
+// every shape, so then all shapes are assigned to the centroids again. The centroids themselves still drift away from
+// the shapes as the store grows: once it has grown to twice the size they were trained on, the index is retrained.
+class IvfIndex {
+public:
+	IvfIndex(const IvfIndex &) = delete;
+
+	IvfIndex &operator=(const IvfIndex &) = delete;
+
+	static std::shared_ptr<IvfIndex> build(const FeatureStore &store, const DatabaseMetadata &metadata);
+
+	// Returns nullptr if there is no index file, if it was built with other settings, or if the shapes it holds are not
+	// the first shapes of the store. Shapes the store holds beyond those still have to be inserted.
+	static std::shared_ptr<IvfIndex> load(const boost::filesystem::path &path, const FeatureStore &store,
+	                                      const DatabaseMetadata &metadata);
+
+	static boost::filesystem::path index_path(const boost::filesystem::path &database_path);
+
+	bool save(const boost::filesystem::path &path) const;
+
+	// Whether the lists hold every shape of the store, normalized as the store is
+	bool matches(const FeatureStore &store) const;
+
+	bool is_weighted_for(const DatabaseMetadata &metadata) const;
+
+	int size() const;
+
+	int list_count() const;
+
+	// Size of the store the centroids were trained on
+	int trained_size() const;
+
+	// Whether the index was last updated for a store normalized with the same statistics as this one
+	bool is_normalized_as(const FeatureStore &store) const;
+
+	// Whether the store has grown so much since the centroids were trained that they have to be trained again
+	bool needs_retraining(const FeatureStore &store) const;
+
+	// Puts the shapes of the store the index does not hold yet in the list of their nearest centroid, and takes over
+	// the normalization of the store. Shapes already held keep their list, unless the store is normalized with other
+	// statistics than the index was, in which case every shape is put in a list again.
+	void insert_new_shapes(const FeatureStore &store);
+
+	// Ids of the shapes in the ivf_probe_count lists whose centroids are nearest to the query, nearest list first
+	std::vector<int> search(const FeatureVector &query, const DatabaseMetadata &metadata) const;
+
+private:
+	std::vector<double> centroids; // list_count() rows of FEATURE_VECTOR_DIMENSION scaled coordinates
+	std::vector<std::vector<int>> lists; // Shape ids nearest to each centroid, in ascending order
+	int shape_count = 0;
+	int trained_shape_count = 0;
+
+	// What the index was built from
+	int64_t generation = 0;
+	uint64_t statistics_checksum = 0;
+	uint64_t filenames_checksum = 0; // Of the filenames of the shapes in the lists, in shape id order
+	DimensionScales scales{};
+
+	IvfIndex() = default;
+
+	static uint64_t checksum_filenames(const FeatureStore &store, int shape_count);
+
+	const double *centroid(int list) const;
+
+	// Distance under which the lists are probed: the L1 distance in the scaled space, which is the squared STD distance
+	static double distance(const double *a, const double *b);
+
+	int nearest_centroid(const double *point) const;
+
+	// k-medians on a sample of the shapes of the store: Lloyd's iterations, assigning samples by the distance lists are
+	// probed with and moving centroids to the median of their samples, the centre under that distance
+	void train(const FeatureStore &store, int list_count);
+
+	// Puts the shapes from first_shape_id on in the list of their nearest centroid, using all cores
+	void assign(const FeatureStore &store, int first_shape_id);
+};
@@ -0,0 +1,256 @@
+#include "pq_index.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include "config.h"
+#include "feature_matching.h"
+
+/*
+ * Index file layout: one header line
+ *     MRPQ <version> <dimension> <shape count> <generation> <statistics checksum> <subspace count> <centroid count>
+ *          <payload checksum>
+ * followed by the payload: the centroids as doubles, in the order of PqIndex::centroids, then the codes.
+ */
+
+static const std::string PQ_INDEX_MAGIC = "MRPQ";
+static const int PQ_INDEX_VERSION = 2;
+
+static const int PQ_TRAINING_SAMPLE_COUNT = 64 * PqIndex::PQ_CENTROID_COUNT;
+static const int PQ_TRAINING_ITERATIONS = 20;
+static const unsigned int PQ_TRAINING_SEED = 1;
+
+// Scales that leave the features as they are, for FeatureMatching::scaled_features()
+static DimensionScales unit_scales() {
+	DimensionScales scales;
+	scales.fill(1.0);
+	return scales;
+}
+
+std::shared_ptr<const PqIndex> PqIndex::build(const FeatureStore &store) {
+	std::shared_ptr<PqIndex> index(new PqIndex());
+	index->generation = store.generation();
+	index->statistics_checksum = store.statistics_checksum();
+
+	index->train(store);
+	index->encode(store);
+	return index;
+}
+
+std::shared_ptr<const PqIndex> PqIndex::load(const boost::filesystem::path &path, const FeatureStore &store) {
+	std::ifstream file(path.string(), std::ios::binary);
+
+	if (!file)
+		return nullptr;
+
+	std::string header_line;
+	std::getline(file, header_line);
+
+	std::istringstream header(header_line);
+	std::string magic;
+	int version = 0;
+	int dimension = 0;
+	int shape_count = 0;
+	int subspace_count = 0;
+	int centroid_count = 0;
+	uint64_t payload_checksum = 0;
+
+	std::shared_ptr<PqIndex> index(new PqIndex());
+
+	header >> magic >> version >> dimension >> shape_count >> index->generation >> index->statistics_checksum
+	       >> subspace_count >> centroid_count >> payload_checksum;
+
+	if (header.fail() || magic != PQ_INDEX_MAGIC || version != PQ_INDEX_VERSION
+	    || dimension != FEATURE_VECTOR_DIMENSION || subspace_count != PQ_SUBSPACE_COUNT
+	    || centroid_count != PQ_CENTROID_COUNT || shape_count != store.size())
+		return nullptr;
+
+	const std::string payload((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	const size_t centroids_size = (size_t) PQ_CENTROID_COUNT * FEATURE_VECTOR_DIMENSION * sizeof(double);
+	const size_t codes_size = (size_t) shape_count * PQ_SUBSPACE_COUNT;
+
+	if (payload.size() != centroids_size + codes_size
+	    || Util::hash(payload.data(), payload.size()) != payload_checksum)
+		return nullptr;
+
+	index->centroids.resize((size_t) PQ_CENTROID_COUNT * FEATURE_VECTOR_DIMENSION);
+	std::memcpy(index->centroids.data(), payload.data(), centroids_size);
+	index->codes.assign(payload.begin() + centroids_size, payload.end());
+
+	if (!index->matches(store))
+		return nullptr;
+
+	return index;
+}
+
+boost::filesystem::path PqIndex::index_path(const boost::filesystem::path &database_path) {
+	return database_path.string() + ".pq";
+}
+
+bool PqIndex::save(const boost::filesystem::path &path) const {
+	std::string payload(reinterpret_cast<const char *>(centroids.data()), centroids.size() * sizeof(double));
+	payload.append(reinterpret_cast<const char *>(codes.data()), codes.size());
+
+	return Util::write_file_atomically(path, [&](std::ostream &file) {
+		file << PQ_INDEX_MAGIC << " " << PQ_INDEX_VERSION << " " << FEATURE_VECTOR_DIMENSION << " " << size()
+		     << " " << generation << " " << statistics_checksum << " " << PQ_SUBSPACE_COUNT << " " << PQ_CENTROID_COUNT
+		     << " " << Util::hash(payload.data(), payload.size()) << "\n" << payload;
+	});
+}
+
+bool PqIndex::matches(const FeatureStore &store) const {
+	return size() == store.size()
+	       && generation == store.generation()
+	       && statistics_checksum == store.statistics_checksum();
+}
+
+int PqIndex::size() const {
+	return codes.size() / PQ_SUBSPACE_COUNT;
+}
+
+std::vector<ShapeMatch> PqIndex::search(const FeatureVector &query, const DatabaseMetadata &metadata,
+                                        int count) const {
+	const DimensionScales scales = FeatureMatching::dimension_scales(metadata);
+	const FeatureVector sorted_query = FeatureStore::sorted_feature_vector(query);
+
+	// distances[subspace * PQ_CENTROID_COUNT + centroid_index]: weighted distance of the query to that centroid
+	std::vector<float> distances(PQ_SUBSPACE_COUNT * PQ_CENTROID_COUNT);
+
+	for (int subspace = 0; subspace < PQ_SUBSPACE_COUNT; subspace++) {
+		const int begin = subspace_begin(subspace);
+
+		for (int centroid_index = 0; centroid_index < PQ_CENTROID_COUNT; centroid_index++) {
+			const double *values = centroid(subspace, centroid_index);
+			double distance = 0;
+
+			for (int i = 0; i < subspace_dimension(subspace); i++)
+				distance += scales[begin + i] * std::abs(sorted_query.values[begin + i] - values[i]);
+
+			distances[subspace * PQ_CENTROID_COUNT + centroid_index] = (float) distance;
+		}
+	}
+
+	TopK nearest(count);
+	const uint8_t *shape_codes = codes.data();
+
+	for (int shape_id = 0; shape_id < size(); shape_id++, shape_codes += PQ_SUBSPACE_COUNT) {
+		float distance = 0;
+
+		for (int subspace = 0; subspace < PQ_SUBSPACE_COUNT; subspace++)
+			distance += distances[subspace * PQ_CENTROID_COUNT + shape_codes[subspace]];
+
+		if (nearest.accepts(distance))
+			nearest.push(shape_id, distance);
+	}
+
+	return nearest.take_sorted();
+}
+
+int PqIndex::subspace_begin(int subspace) {
+	return subspace == 0 ? 0 : GLOBAL_DESCRIPTOR_COUNT + (subspace - 1) * HISTOGRAM_BAR_COUNT;
+}
+
+int PqIndex::subspace_dimension(int subspace) {
+	return subspace == 0 ? GLOBAL_DESCRIPTOR_COUNT : HISTOGRAM_BAR_COUNT;
+}
+
+const double *PqIndex::centroid(int subspace, int centroid_index) const {
+	return centroids.data() + PQ_CENTROID_COUNT * subspace_begin(subspace)
+	       + centroid_index * subspace_dimension(subspace);
+}
+
+int PqIndex::nearest_centroid(int subspace, const double *features) const {
+	const double *values = features + subspace_begin(subspace);
+	int nearest = 0;
+	double nearest_distance = INFINITY;
+
+	for (int centroid_index = 0; centroid_index < PQ_CENTROID_COUNT; centroid_index++) {
+		const double *centroid_values = centroid(subspace, centroid_index);
+		double distance = 0;
+
+		for (int i = 0; i < subspace_dimension(subspace); i++)
+			distance += std::abs(values[i] - centroid_values[i]);
+
+		if (distance < nearest_distance) {
+			nearest = centroid_index;
+			nearest_distance = distance;
+		}
+	}
+
+	return nearest;
+}
+
+void PqIndex::train(const FeatureStore &store) {
+	const DimensionScales scales = unit_scales();
+	const int sample_count = std::min(store.size(), PQ_TRAINING_SAMPLE_COUNT);
+
+	// Every shape if there are few, otherwise shapes spread evenly over the store
+	std::vector<double> samples((size_t) sample_count * FEATURE_VECTOR_DIMENSION);
+
+	for (int i = 0; i < sample_count; i++)
+		FeatureMatching::scaled_features(store, (int) ((long long) i * store.size() / sample_count), scales,
+		                                 samples.data() + (size_t) i * FEATURE_VECTOR_DIMENSION);
+
+	centroids.assign((size_t) PQ_CENTROID_COUNT * FEATURE_VECTOR_DIMENSION, 0.0);
+
+	if (sample_count == 0)
+		return;
+
+	// Centroids start at samples drawn from a fixed seed, so a build is reproducible
+	std::vector<int> order(sample_count);
+	std::iota(order.begin(), order.end(), 0);
+	std::shuffle(order.begin(), order.end(), std::mt19937(PQ_TRAINING_SEED));
+
+	for (int subspace = 0; subspace < PQ_SUBSPACE_COUNT; subspace++) {
+		const int begin = subspace_begin(subspace);
+		const int dimension = subspace_dimension(subspace);
+		double *subspace_centroids = centroids.data() + PQ_CENTROID_COUNT * begin;
+
+		for (int centroid_index = 0; centroid_index < PQ_CENTROID_COUNT; centroid_index++) {
+			const double *sample = samples.data()
+			                       + (size_t) order[centroid_index % sample_count] * FEATURE_VECTOR_DIMENSION;
+			std::copy(sample + begin, sample + begin + dimension, subspace_centroids + centroid_index * dimension);
+		}
+
+		std::vector<int> assignments(sample_count, -1);
+
+		for (int iteration = 0; iteration < PQ_TRAINING_ITERATIONS; iteration++) {
+			std::vector<char> changed(sample_count, false);
+
+			Util::parallel_for(sample_count, [&](int first, int last) {
+				for (int i = first; i < last; i++) {
+					const double *sample = samples.data() + (size_t) i * FEATURE_VECTOR_DIMENSION;
+					const int nearest = nearest_centroid(subspace, sample);
+					changed[i] = nearest != assignments[i];
+					assignments[i] = nearest;
+				}
+			});
+
+			if (std::find(changed.begin(), changed.end(), true) == changed.end())
+				break;
+
+			Util::move_centroids_to_medians(samples, FEATURE_VECTOR_DIMENSION, begin, dimension, assignments,
+			                                PQ_CENTROID_COUNT, subspace_centroids);
+		}
+	}
+}
+
+void PqIndex::encode(const FeatureStore &store) {
+	const DimensionScales scales = unit_scales();
+	codes.assign((size_t) store.size() * PQ_SUBSPACE_COUNT, 0);
+
+	Util::parallel_for(store.size(), [&](int first, int last) {
+		double features[FEATURE_VECTOR_DIMENSION];
+
+		for (int shape_id = first; shape_id < last; shape_id++) {
+			FeatureMatching::scaled_features(store, shape_id, scales, features);
+
+			for (int subspace = 0; subspace < PQ_SUBSPACE_COUNT; subspace++)
+				codes[(size_t) shape_id * PQ_SUBSPACE_COUNT + subspace] =
+						(uint8_t) nearest_centroid(subspace, features);
+		}
+	});
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+#include "database_mr.h"
+#include "feature_store.h"
+#include "top_k.h"
+#include "util.h"
+
+// Product quantization (Jegou, Douze and Schmid) of the sorted feature vectors of a feature store, used by PQ matching.
+// The vectors are split into PQ_SUBSPACE_COUNT sub-spaces: the global descriptors, and one per histogram. A k-medians
+// codebook of PQ_CENTROID_COUNT centroids is trained for each, and every shape is stored as the byte index of its
+// nearest centroid in every sub-space, so a million shapes take a few megabytes. Shapes are assigned to centroids by
+// the L1 distance a search ranks them by, and medians are the centroids that minimize it.
+// Codebooks are trained on unweighted features, so one index serves any weights. --build-index persists it next to the
+// database; it is rebuilt when the shapes or statistics it was built from change.
+class PqIndex {
+public:
+	static const int PQ_SUBSPACE_COUNT = 1 + PROPERTY_DESCRIPTOR_COUNT;
+	static const int PQ_CENTROID_COUNT = 256;
+
+	PqIndex(const PqIndex &) = delete;
+
+	PqIndex &operator=(const PqIndex &) = delete;
+
+	static std::shared_ptr<const PqIndex> build(const FeatureStore &store);
+
+	// Returns nullptr if there is no index file, or if it was built from other data than the store holds
+	static std::shared_ptr<const PqIndex> load(const boost::filesystem::path &path, const FeatureStore &store);
+
+	static boost::filesystem::path index_path(const boost::filesystem::path &database_path);
+
+	bool save(const boost::filesystem::path &path) const;
+
+	bool matches(const FeatureStore &store) const;
+
+	int size() const;
+
+	// The count shapes nearest to the query by the weighted STD distance to their centroids, looked up in one table per
+	// query (asymmetric distance computation); nearest first, with those approximate squared distances
+	std::vector<ShapeMatch> search(const FeatureVector &query, const DatabaseMetadata &metadata, int count) const;
+
+private:
+	// For every sub-space, PQ_CENTROID_COUNT centroids of subspace_dimension() values each. The centroids of
+	// sub-space s start at PQ_CENTROID_COUNT * subspace_begin(s).
+	std::vector<double> centroids;
+	std::vector<uint8_t> codes; // PQ_SUBSPACE_COUNT per shape
+
+	// What the index was built from
+	int64_t generation = 0;
+	uint64_t statistics_checksum = 0;
+
+	PqIndex() = default;
+
+	// First dimension of the feature vector in the sub-space
+	static int subspace_begin(int subspace);
+
+	static int subspace_dimension(int subspace);
+
+	const double *centroid(int subspace, int centroid_index) const;
+
+	// Index of the centroid of the sub-space nearest (in L1 distance) to the sub-vector of features
+	int nearest_centroid(int subspace, const double *features) const;
+
+	// Lloyd's iterations with medians (k-medians) on a sample of the shapes of the store, for every sub-space
+	void train(const FeatureStore &store);
+
+	// Sets the codes of every shape of the store, using all cores
+	void encode(const FeatureStore &store);
+};
@@ -60,17 +60,23 @@ DatabaseShape Preprocessing::extract_shape(SurfaceMesh mesh, bool print) {
 	return FeatureExtraction::get_shape_features(mesh, false);
 }
 
-DatabaseShape Preprocessing::normalize_features_for_shape(const DatabaseShape &shape, bool print) {
-	return FeatureExtraction::get_normalized_shape_features(shape, print);
+DatabaseShape Preprocessing::extract_shape(SurfaceMesh mesh, int property_item_count, bool print) {
+	return FeatureExtraction::get_shape_features(mesh, property_item_count, false);
+}
+
+DatabaseShape Preprocessing::normalize_features_for_shape(const DatabaseShape &shape,
+                                                         const DatabaseStatistics &statistics, bool print) {
+	return FeatureExtraction::get_normalized_shape_features(shape, statistics, print);
 }
 
 std::vector<DatabaseShape>
-Preprocessing::normalize_features_for_shapes(const std::vector<DatabaseShape> &shapes, bool print) {
+Preprocessing::normalize_features_for_shapes(const std::vector<DatabaseShape> &shapes,
+                                             const DatabaseStatistics &statistics, bool print) {
 	std::vector<DatabaseShape> result_shapes;
 
 	result_shapes.reserve(shapes.size());
 	for (const auto &shape : shapes)
-		result_shapes.push_back(normalize_features_for_shape(shape, print));
+		result_shapes.push_back(normalize_features_for_shape(shape, statistics, print));
 
 	return result_shapes;
 }
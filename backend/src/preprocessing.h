@@ -12,8 +12,9 @@ public:
 	static void flip_all_faces(const std::string& file_path, int vertex_count, bool print);
 
 	static DatabaseShape extract_shape(SurfaceMesh mesh, bool print);
+	static DatabaseShape extract_shape(SurfaceMesh mesh, int property_item_count, bool print);
 	static std::vector<DatabaseShape> extract_shapes(const std::vector<SurfaceMesh>& meshes, bool print);
 
-	static DatabaseShape normalize_features_for_shape(const DatabaseShape& shape, bool print);
-	static std::vector<DatabaseShape> normalize_features_for_shapes(const std::vector<DatabaseShape>& shapes, bool print);
+	static DatabaseShape normalize_features_for_shape(const DatabaseShape& shape, const DatabaseStatistics& statistics, bool print);
+	static std::vector<DatabaseShape> normalize_features_for_shapes(const std::vector<DatabaseShape>& shapes, const DatabaseStatistics& statistics, bool print);
 };
@@ -0,0 +1,249 @@
+#include "query_cache.h"
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include "ann_index.h"
+#include "hnsw_index.h"
+#include "ivf_index.h"
+#include "pq_index.h"
+
+/*
+ * Cache file layout: one header line
+ *     MRQC <version> <fingerprint> <entry count> <payload checksum>
+ * followed by the payload: for every entry, most recently used first, its key (uint64_t), its match count (int32_t)
+ * and that many matches, each its shard (int32_t), filename length (uint32_t) and filename characters.
+ */
+
+static const std::string QUERY_CACHE_MAGIC = "MRQC";
+static const int QUERY_CACHE_VERSION = 3;
+
+// The index file a method searches, if it searches one
+static boost::filesystem::path index_path(const boost::filesystem::path &database_path,
+                                          Util::FeatureMatchingMethod method) {
+	switch (method) {
+		case Util::FeatureMatchingMethod::KNN:
+		case Util::FeatureMatchingMethod::RNN:
+		case Util::FeatureMatchingMethod::RANGE:
+			return AnnIndex::index_path(database_path);
+		case Util::FeatureMatchingMethod::HNSW:
+			return HnswIndex::index_path(database_path);
+		case Util::FeatureMatchingMethod::PQ:
+			return PqIndex::index_path(database_path);
+		case Util::FeatureMatchingMethod::IVF:
+			return IvfIndex::index_path(database_path);
+		default:
+			return {};
+	}
+}
+
+std::shared_ptr<QueryCache> QueryCache::load(const boost::filesystem::path &path, uint64_t fingerprint, int capacity) {
+	std::shared_ptr<QueryCache> cache(new QueryCache());
+	cache->cache_fingerprint = fingerprint;
+	cache->capacity = std::max(capacity, 0);
+
+	std::ifstream file(path.string(), std::ios::binary);
+
+	if (!file)
+		return cache;
+
+	std::string header_line;
+	std::getline(file, header_line);
+
+	std::istringstream header(header_line);
+	std::string magic;
+	int version = 0;
+	uint64_t file_fingerprint = 0;
+	int entry_count = 0;
+	uint64_t payload_checksum = 0;
+
+	header >> magic >> version >> file_fingerprint >> entry_count >> payload_checksum;
+
+	if (header.fail() || magic != QUERY_CACHE_MAGIC || version != QUERY_CACHE_VERSION
+	    || file_fingerprint != fingerprint || entry_count < 0)
+		return cache;
+
+	const std::string payload((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+	if (Util::hash(payload.data(), payload.size()) != payload_checksum)
+		return cache;
+
+	std::list<Entry> entries;
+	size_t offset = 0;
+
+	for (int i = 0; i < entry_count; i++) {
+		Entry entry;
+		int32_t match_count = 0;
+
+		if (payload.size() - offset < sizeof(entry.first) + sizeof(match_count))
+			return cache;
+
+		std::memcpy(&entry.first, payload.data() + offset, sizeof(entry.first));
+		std::memcpy(&match_count, payload.data() + offset + sizeof(entry.first), sizeof(match_count));
+		offset += sizeof(entry.first) + sizeof(match_count);
+
+		if (match_count < 0)
+			return cache;
+
+		for (int j = 0; j < match_count; j++) {
+			int32_t shard = 0;
+			uint32_t filename_length = 0;
+
+			if (payload.size() - offset < sizeof(shard) + sizeof(filename_length))
+				return cache;
+
+			std::memcpy(&shard, payload.data() + offset, sizeof(shard));
+			std::memcpy(&filename_length, payload.data() + offset + sizeof(shard), sizeof(filename_length));
+			offset += sizeof(shard) + sizeof(filename_length);
+
+			if (payload.size() - offset < filename_length)
+				return cache;
+
+			entry.second.push_back({shard, payload.substr(offset, filename_length)});
+			offset += filename_length;
+		}
+
+		entries.push_back(std::move(entry));
+	}
+
+	// Entries beyond a capacity lowered since the file was written are the least recently used
+	for (Entry &entry : entries) {
+		if ((int) cache->entries.size() == cache->capacity)
+			break;
+
+		if (cache->positions.count(entry.first) == 0) {
+			cache->entries.push_back(std::move(entry));
+			cache->positions[cache->entries.back().first] = std::prev(cache->entries.end());
+		}
+	}
+
+	return cache;
+}
+
+boost::filesystem::path QueryCache::cache_path(const boost::filesystem::path &database_path) {
+	return database_path.string() + ".qcache";
+}
+
+uint64_t QueryCache::fingerprint(const std::vector<std::string> &database_paths,
+                                 const std::vector<DatabaseMetadata> &shard_metadata,
+                                 const DatabaseStatistics &statistics, const DatabaseMetadata &metadata) {
+	std::ostringstream settings;
+	settings << std::setprecision(std::numeric_limits<double>::max_digits10)
+	         << metadata.feature_matching_method << " " << metadata.maximum_returned_matches << " "
+	         << metadata.maximum_feature_matching_distance << " "
+	         << metadata.weight_surface_area << " " << metadata.weight_compactness << " "
+	         << metadata.weight_volume << " " << metadata.weight_diameter << " " << metadata.weight_eccentricity << " "
+	         << metadata.weight_A3 << " " << metadata.weight_D1 << " " << metadata.weight_D2 << " "
+	         << metadata.weight_D3 << " " << metadata.weight_D4 << " "
+	         << metadata.ann_eps << " " << metadata.ann_search_strategy << " " << metadata.ann_max_points_visited << " "
+	         << metadata.ann_tree << " " << metadata.ann_split_rule << " " << metadata.ann_shrink_rule << " "
+	         << metadata.hnsw_m << " " << metadata.hnsw_ef_construction << " " << metadata.hnsw_ef_search << " "
+	         << metadata.candidate_pool_multiplier << " " << metadata.ivf_list_count << " " << metadata.ivf_probe_count
+	         << " " << FeatureStore::checksum(statistics);
+
+	// The generation of a shard changes with every shape stored in it. A rebuilt index can find other shapes without
+	// any change to the database.
+	for (int shard = 0; shard < shard_metadata.size(); shard++) {
+		const boost::filesystem::path shard_index_path = index_path(database_paths[shard],
+		                                                            metadata.feature_matching_method);
+		boost::system::error_code error_code;
+		const std::time_t index_time = shard_index_path.empty()
+		                               ? 0 : boost::filesystem::last_write_time(shard_index_path, error_code);
+
+		settings << " " << boost::filesystem::absolute(database_paths[shard]).string() << " "
+		         << shard_metadata[shard].generation << " " << (error_code ? 0 : index_time);
+	}
+
+	const std::string fingerprint = settings.str();
+	return Util::hash(fingerprint.data(), fingerprint.size());
+}
+
+bool QueryCache::key(const boost::filesystem::path &input_path, int sample_count, uint64_t &key) {
+	std::ifstream file(input_path.string(), std::ios::binary);
+
+	if (!file)
+		return false;
+
+	const std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+	if (file.bad())
+		return false;
+
+	// Whether a query is in the database is decided by its filename, so the filename is part of the key
+	const std::string filename = Util::filename_of_abs_path(input_path);
+	key = Util::hash(filename.c_str(), filename.size() + 1); // Terminator included as separator
+	key = Util::hash(contents.data(), contents.size(), key);
+	key = Util::hash(&sample_count, sizeof(sample_count), key);
+	return true;
+}
+
+bool QueryCache::save(const boost::filesystem::path &path) const {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (!changed)
+		return true;
+
+	std::string payload;
+
+	for (const Entry &entry : entries) {
+		const int32_t match_count = entry.second.size();
+
+		payload.append(reinterpret_cast<const char *>(&entry.first), sizeof(entry.first));
+		payload.append(reinterpret_cast<const char *>(&match_count), sizeof(match_count));
+
+		for (const CachedMatch &match : entry.second) {
+			const int32_t shard = match.shard;
+			const uint32_t filename_length = match.filename.size();
+
+			payload.append(reinterpret_cast<const char *>(&shard), sizeof(shard));
+			payload.append(reinterpret_cast<const char *>(&filename_length), sizeof(filename_length));
+			payload.append(match.filename);
+		}
+	}
+
+	return Util::write_file_atomically(path, [&](std::ostream &file) {
+		file << QUERY_CACHE_MAGIC << " " << QUERY_CACHE_VERSION << " " << cache_fingerprint << " " << entries.size()
+		     << " " << Util::hash(payload.data(), payload.size()) << "\n" << payload;
+	});
+}
+
+bool QueryCache::find(uint64_t key, std::vector<CachedMatch> &matches) {
+	std::lock_guard<std::mutex> lock(mutex);
+	const auto position = positions.find(key);
+
+	if (position == positions.end())
+		return false;
+
+	if (position->second != entries.begin()) {
+		entries.splice(entries.begin(), entries, position->second);
+		changed = true;
+	}
+
+	matches = entries.front().second;
+	return true;
+}
+
+void QueryCache::insert(uint64_t key, const std::vector<CachedMatch> &matches) {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (capacity == 0)
+		return;
+
+	const auto position = positions.find(key);
+
+	if (position != positions.end()) {
+		position->second->second = matches;
+		entries.splice(entries.begin(), entries, position->second);
+	} else {
+		entries.emplace_front(key, matches);
+		positions[key] = entries.begin();
+	}
+
+	while ((int) entries.size() > capacity) {
+		positions.erase(entries.back().first);
+		entries.pop_back();
+	}
+
+	changed = true;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "database_mr.h"
+#include "feature_matching.h"
+#include "feature_store.h"
+
+// A match as the cache keeps it. Shape ids are only known once the feature stores are loaded, which a hit avoids.
+struct CachedMatch {
+	int shard;
+	std::string filename;
+};
+
+// Results of earlier --query runs, kept next to the (first) database so a mesh queried again is answered without
+// loading the feature stores or matching. Entries are keyed by the filename and contents of the query mesh, and the
+// whole cache by a fingerprint of the databases and matching settings, so any change to the shapes, statistics,
+// indexes or settings empties it. Everything the fingerprint is taken of is read without loading a feature store.
+// Holds at most query_cache_capacity entries, dropping the least recently used first. Safe to use from several threads.
+class QueryCache {
+public:
+	QueryCache(const QueryCache &) = delete;
+
+	QueryCache &operator=(const QueryCache &) = delete;
+
+	// An empty cache if there is no cache file, or if it was written for another fingerprint
+	static std::shared_ptr<QueryCache> load(const boost::filesystem::path &path, uint64_t fingerprint, int capacity);
+
+	static boost::filesystem::path cache_path(const boost::filesystem::path &database_path);
+
+	// Of everything the results of a query depend on besides the query itself: the metadata of every shard, the
+	// statistics the shards are normalized with, and the matching settings
+	static uint64_t fingerprint(const std::vector<std::string> &database_paths,
+	                            const std::vector<DatabaseMetadata> &shard_metadata,
+	                            const DatabaseStatistics &statistics, const DatabaseMetadata &metadata);
+
+	// Of the filename and contents of a query mesh, and of the samples per histogram a mesh that is not in the
+	// database is extracted with. Returns false if the mesh cannot be read.
+	static bool key(const boost::filesystem::path &input_path, int sample_count, uint64_t &key);
+
+	// Writes nothing if no entry was added or used since loading
+	bool save(const boost::filesystem::path &path) const;
+
+	// Fills matches and marks the entry most recently used, if there is one for key
+	bool find(uint64_t key, std::vector<CachedMatch> &matches);
+
+	void insert(uint64_t key, const std::vector<CachedMatch> &matches);
+
+private:
+	typedef std::pair<uint64_t, std::vector<CachedMatch>> Entry;
+
+	mutable std::mutex mutex;
+	std::list<Entry> entries; // Most recently used first
+	std::unordered_map<uint64_t, std::list<Entry>::iterator> positions;
+	uint64_t cache_fingerprint = 0;
+	int capacity = 0;
+	bool changed = false;
+
+	QueryCache() = default;
+};
@@ -0,0 +1,113 @@
+#include "shards.h"
+#include <fstream>
+#include <thread>
+
+std::vector<std::string> Shards::expand(const std::vector<std::string> &database_arguments) {
+	std::vector<std::string> database_paths;
+
+	for (const std::string &database_argument : database_arguments) {
+		boost::filesystem::path path = boost::filesystem::absolute(database_argument);
+
+		if (!is_manifest(path)) {
+			database_paths.push_back(path.string());
+			continue;
+		}
+
+		std::ifstream manifest(path.string());
+		std::string line;
+
+		while (std::getline(manifest, line)) {
+			boost::algorithm::trim(line);
+
+			if (line.empty() || line[0] == '#')
+				continue;
+
+			boost::filesystem::path shard_path(line);
+			if (shard_path.is_relative())
+				shard_path = path.parent_path() / shard_path;
+
+			database_paths.push_back(shard_path.string());
+		}
+	}
+
+	return database_paths;
+}
+
+bool Shards::is_manifest(const boost::filesystem::path &path) {
+	if (!boost::filesystem::is_regular_file(path) || boost::filesystem::file_size(path) == 0)
+		return false;
+
+	// Every SQLite database starts with this header, including its null terminator
+	const std::string sqlite_header("SQLite format 3", 16);
+
+	std::ifstream file(path.string(), std::ios::binary);
+	std::string file_header(sqlite_header.size(), '\0');
+	file.read(&file_header[0], file_header.size());
+
+	return file_header != sqlite_header;
+}
+
+std::vector<DatabaseMetadata> Shards::metadata(const std::vector<std::string> &database_paths) {
+	std::vector<DatabaseMetadata> metadata;
+
+	for (const std::string &database_path : database_paths) {
+		Database database;
+		database.open_read_only(database_path);
+		metadata.push_back(database.metadata());
+	}
+
+	return metadata;
+}
+
+DatabaseStatistics Shards::merged_statistics(const std::vector<std::string> &database_paths) {
+	DatabaseStatistics statistics = DatabaseStatistics();
+
+	for (const std::string &database_path : database_paths) {
+		Database database;
+		database.open_read_only(database_path);
+		DatabaseStatistics shard_statistics = database.statistics();
+
+		statistics.surface_area = Util::merge_running_statistics(statistics.surface_area,
+		                                                         shard_statistics.surface_area);
+		statistics.compactness = Util::merge_running_statistics(statistics.compactness, shard_statistics.compactness);
+		statistics.volume = Util::merge_running_statistics(statistics.volume, shard_statistics.volume);
+		statistics.diameter = Util::merge_running_statistics(statistics.diameter, shard_statistics.diameter);
+		statistics.eccentricity = Util::merge_running_statistics(statistics.eccentricity,
+		                                                         shard_statistics.eccentricity);
+	}
+
+	return statistics;
+}
+
+void Shards::refresh(const std::vector<std::string> &database_paths, bool print) {
+	const DatabaseStatistics statistics = merged_statistics(database_paths);
+
+	for (const std::string &database_path : database_paths) {
+		Database database;
+		database.open(database_path);
+		FeatureStore::load(database, statistics, print);
+	}
+}
+
+std::vector<FeatureStore>
+Shards::load(const std::vector<std::string> &database_paths, const DatabaseStatistics &statistics,
+             std::vector<DatabaseMetadata> &metadata, bool print) {
+	std::vector<FeatureStore> stores(database_paths.size());
+	std::vector<std::thread> threads;
+
+	metadata.assign(database_paths.size(), DatabaseMetadata());
+
+	for (int shard = 0; shard < database_paths.size(); shard++) {
+		threads.emplace_back([&, shard]() {
+			Database database;
+			database.open_read_only(database_paths[shard]);
+			metadata[shard] = database.metadata();
+			stores[shard] = FeatureStore::load(database, statistics, print);
+		});
+	}
+
+	for (std::thread &thread : threads)
+		thread.join();
+
+	return stores;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <string>
+#include <vector>
+#include "database_mr.h"
+#include "feature_store.h"
+
+// A library can be split over several database files ("shards"), each built with its own --extract run.
+// Shards are listed on the command line, or in a manifest: a text file with one database path per line,
+// relative to the manifest. Empty lines and lines starting with '#' are ignored.
+// Shards are only read: every shard is opened read-only, and a snapshot or index found out of date is refreshed in
+// memory only. --store, --extract and --build-index write them, given the same shards.
+class Shards {
+public:
+	// Replaces every manifest by the database files it lists
+	static std::vector<std::string> expand(const std::vector<std::string> &database_arguments);
+
+	static bool is_manifest(const boost::filesystem::path &path);
+
+	// The metadata of every shard, without loading its features
+	static std::vector<DatabaseMetadata> metadata(const std::vector<std::string> &database_paths);
+
+	// Statistics over all shards combined, so that every shard is normalized the same way
+	static DatabaseStatistics merged_statistics(const std::vector<std::string> &database_paths);
+
+	// Regenerates the snapshot and the stored indexes of every shard that are out of date for the merged statistics,
+	// and writes them next to the shard, so that --query over these shards maps them as they are
+	static void refresh(const std::vector<std::string> &database_paths, bool print);
+
+	// Loads the feature store of every shard in parallel, normalized with the merged statistics
+	static std::vector<FeatureStore>
+	load(const std::vector<std::string> &database_paths, const DatabaseStatistics &statistics,
+	     std::vector<DatabaseMetadata> &metadata, bool print);
+};
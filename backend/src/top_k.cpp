@@ -0,0 +1,50 @@
+#include "top_k.h"
+
+#include <algorithm>
+
+TopK::TopK(int k) : k(std::max(k, 0)) {
+	heap.reserve(this->k);
+}
+
+bool TopK::accepts(double distance) const {
+	if (size() < k)
+		return true;
+
+	return k > 0 && distance <= heap.front().distance;
+}
+
+void TopK::push(int shape_id, double distance) {
+	const ShapeMatch match = {shape_id, distance};
+
+	if (size() < k) {
+		heap.push_back(match);
+		std::push_heap(heap.begin(), heap.end(), is_closer);
+	} else if (k > 0 && is_closer(match, heap.front())) {
+		std::pop_heap(heap.begin(), heap.end(), is_closer);
+		heap.back() = match;
+		std::push_heap(heap.begin(), heap.end(), is_closer);
+	}
+}
+
+int TopK::size() const {
+	return heap.size();
+}
+
+double TopK::furthest_distance() const {
+	return heap.front().distance;
+}
+
+std::vector<ShapeMatch> TopK::take_sorted() {
+	std::sort_heap(heap.begin(), heap.end(), is_closer);
+
+	std::vector<ShapeMatch> matches;
+	matches.swap(heap);
+	return matches;
+}
+
+bool TopK::is_closer(const ShapeMatch &a, const ShapeMatch &b) {
+	if (a.distance != b.distance)
+		return a.distance < b.distance;
+
+	return a.shape_id < b.shape_id;
+}
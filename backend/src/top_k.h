@@ -0,0 +1,34 @@
+#pragma once
+
+#include <vector>
+
+struct ShapeMatch {
+	int shape_id;
+	double distance;
+};
+
+// Keeps the k closest shapes offered to it, in O(log k) per offer.
+// Matches are ordered by distance, and equal distances by shape id, so no match is lost to a tie.
+class TopK {
+public:
+	explicit TopK(int k);
+
+	// Whether a match at this distance could still be kept; lets callers skip work for hopeless candidates
+	bool accepts(double distance) const;
+
+	void push(int shape_id, double distance);
+
+	int size() const;
+
+	// Distance of the furthest kept match; only valid while size() > 0
+	double furthest_distance() const;
+
+	// The kept matches, closest first. Empties the selector.
+	std::vector<ShapeMatch> take_sorted();
+
+	static bool is_closer(const ShapeMatch &a, const ShapeMatch &b);
+
+private:
+	int k;
+	std::vector<ShapeMatch> heap; // Max-heap on is_closer: the furthest kept match is at the front
+};
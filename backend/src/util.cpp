@@ -1,4 +1,7 @@
 #include <boost/lexical_cast.hpp>
+#include <fstream>
+#include <numeric>
+#include <thread>
 #include "util.h"
 
 
@@ -65,6 +68,65 @@ double Util::standard_deviation(const std::vector<double> &numbers) {
 	return standard_deviation;
 }
 
+void Util::add_to_running_statistics(RunningStatistics &statistics, double number) {
+	// Welford's online algorithm
+	statistics.count++;
+
+	double delta = number - statistics.mean;
+	statistics.mean += delta / statistics.count;
+	statistics.m2 += delta * (number - statistics.mean);
+}
+
+void Util::remove_from_running_statistics(RunningStatistics &statistics, double number) {
+	if (statistics.count <= 1) {
+		statistics = RunningStatistics();
+		return;
+	}
+
+	double old_mean = statistics.mean;
+	statistics.count--;
+	statistics.mean = (old_mean * (statistics.count + 1) - number) / statistics.count;
+	statistics.m2 -= (number - old_mean) * (number - statistics.mean);
+
+	if (statistics.m2 < 0.0)
+		statistics.m2 = 0.0;
+}
+
+double Util::running_standard_deviation(const RunningStatistics &statistics) {
+	if (statistics.count == 0)
+		return 0.0;
+
+	return sqrt(statistics.m2 / statistics.count);
+}
+
+RunningStatistics Util::merge_running_statistics(const RunningStatistics &a, const RunningStatistics &b) {
+	if (a.count == 0)
+		return b;
+	if (b.count == 0)
+		return a;
+
+	RunningStatistics statistics = RunningStatistics();
+	statistics.count = a.count + b.count;
+
+	double delta = b.mean - a.mean;
+	statistics.mean = a.mean + delta * b.count / statistics.count;
+	statistics.m2 = a.m2 + b.m2 + delta * delta * a.count * b.count / statistics.count;
+
+	return statistics;
+}
+
+uint64_t Util::hash(const void *data, size_t size, uint64_t seed) {
+	const auto *bytes = static_cast<const unsigned char *>(data);
+	uint64_t hash = seed;
+
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
 std::string Util::serialize(const std::vector<double> &vec) {
 	std::string result;
 
@@ -94,6 +156,11 @@ std::vector<double> Util::deserialize(const std::string &str) {
 	return result;
 }
 
+std::vector<double> Util::sorted(std::vector<double> numbers) {
+	std::sort(numbers.begin(), numbers.end());
+	return numbers;
+}
+
 std::string Util::filename_of_abs_path(const boost::filesystem::path &abs_path) {
 	int index_of_last_separator;
 
@@ -128,6 +195,82 @@ std::vector<int> Util::random_numbers(int amount_of_numbers, int maximum_range)
 	return random_numbers;
 }
 
+void Util::parallel_for(int count, const std::function<void(int, int)> &function) {
+	const int thread_count = std::max(1, std::min<int>(std::thread::hardware_concurrency(), count));
+	std::vector<std::thread> threads;
+
+	for (int thread = 0; thread < thread_count; thread++) {
+		threads.emplace_back(function, (int) ((long long) thread * count / thread_count),
+		                     (int) ((long long) (thread + 1) * count / thread_count));
+	}
+
+	for (std::thread &thread : threads)
+		thread.join();
+}
+
+void Util::move_centroids_to_medians(const std::vector<double> &samples, int sample_stride, int first_coordinate,
+                                     int dimension, const std::vector<int> &assignments, int centroid_count,
+                                     double *centroids) {
+	// The samples of every centroid, grouped by centroid: those of centroid c from first_samples[c] on
+	std::vector<int> first_samples(centroid_count + 1, 0);
+
+	for (int assignment : assignments)
+		first_samples[assignment + 1]++;
+
+	std::partial_sum(first_samples.begin(), first_samples.end(), first_samples.begin());
+
+	std::vector<int> grouped_samples(assignments.size());
+	std::vector<int> next_samples(first_samples.begin(), first_samples.end() - 1);
+
+	for (int i = 0; i < assignments.size(); i++)
+		grouped_samples[next_samples[assignments[i]]++] = i;
+
+	std::vector<double> values;
+
+	for (int centroid = 0; centroid < centroid_count; centroid++) {
+		const int first = first_samples[centroid];
+		const int count = first_samples[centroid + 1] - first;
+
+		if (count == 0)
+			continue;
+
+		for (int j = 0; j < dimension; j++) {
+			values.resize(count);
+
+			for (int i = 0; i < count; i++)
+				values[i] = samples[(size_t) grouped_samples[first + i] * sample_stride + first_coordinate + j];
+
+			std::nth_element(values.begin(), values.begin() + count / 2, values.end());
+			centroids[(size_t) centroid * dimension + j] = values[count / 2];
+		}
+	}
+}
+
+bool Util::write_file_atomically(const boost::filesystem::path &path,
+                                 const std::function<void(std::ostream &)> &write) {
+	const boost::filesystem::path temporary_path =
+			path.string() + boost::filesystem::unique_path(".%%%%-%%%%-%%%%-%%%%.tmp").string();
+
+	bool written;
+	{
+		std::ofstream file(temporary_path.string(), std::ios::binary | std::ios::trunc);
+		write(file);
+		file.close();
+		written = !file.fail();
+	}
+
+	boost::system::error_code error_code;
+	if (written)
+		boost::filesystem::rename(temporary_path, path, error_code);
+
+	if (!written || error_code) {
+		boost::filesystem::remove(temporary_path, error_code);
+		return false;
+	}
+
+	return true;
+}
+
 std::vector<boost::filesystem::path>
 Util::files_to_vector(const boost::filesystem::path &if_abs_path, const std::string &extension) {
 	std::vector<boost::filesystem::path> file_paths = std::vector<boost::filesystem::path>();
@@ -3,15 +3,28 @@
 
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
+#include <functional>
 #include <string>
 #include <pmp/SurfaceMesh.h>
 
+struct RunningStatistics {
+	int count;
+	double mean;
+	double m2; // Sum of squared differences from the mean
+};
+
 class Util {
 public:
 	enum FeatureMatchingMethod {
 		STD,
 		KNN,
 		RNN,
+		HNSW,
+		SQ8,
+		PQ,
+		GLOBAL,
+		RANGE,
+		IVF,
 	};
 
 	static inline std::string ToString(FeatureMatchingMethod v) {
@@ -22,11 +35,122 @@ public:
 				return "KNN";
 			case RNN:
 				return "RNN";
+			case HNSW:
+				return "HNSW";
+			case SQ8:
+				return "SQ8";
+			case PQ:
+				return "PQ";
+			case GLOBAL:
+				return "GLOBAL";
+			case RANGE:
+				return "RANGE";
+			case IVF:
+				return "IVF";
 			default:
 				return "[Unknown FeatureMatchingMethod]";
 		}
 	}
 
+	// How KNN searches the ANN index: ANNkd_tree::annkSearch or annkPriSearch. RNN always searches the standard way.
+	enum AnnSearchStrategy {
+		STANDARD,
+		PRIORITY,
+	};
+
+	static inline std::string ToString(AnnSearchStrategy v) {
+		switch (v) {
+			case STANDARD:
+				return "STANDARD";
+			case PRIORITY:
+				return "PRIORITY";
+			default:
+				return "[Unknown AnnSearchStrategy]";
+		}
+	}
+
+	// The structure of the ANN index; see ANNkd_tree and ANNbd_tree
+	enum AnnTree {
+		KD_TREE,
+		BD_TREE,
+	};
+
+	// In the order of ANNsplitRule
+	enum AnnSplitRule {
+		KD_STD,
+		KD_MIDPT,
+		KD_FAIR,
+		KD_SL_MIDPT,
+		KD_SL_FAIR,
+		KD_SUGGEST,
+	};
+
+	// In the order of ANNshrinkRule; only bd-trees shrink
+	enum AnnShrinkRule {
+		BD_NONE,
+		BD_SIMPLE,
+		BD_CENTROID,
+		BD_SUGGEST,
+	};
+
+	static inline std::string ToString(AnnTree v) {
+		switch (v) {
+			case KD_TREE:
+				return "KD_TREE";
+			case BD_TREE:
+				return "BD_TREE";
+			default:
+				return "[Unknown AnnTree]";
+		}
+	}
+
+	static inline std::string ToString(AnnSplitRule v) {
+		switch (v) {
+			case KD_STD:
+				return "KD_STD";
+			case KD_MIDPT:
+				return "KD_MIDPT";
+			case KD_FAIR:
+				return "KD_FAIR";
+			case KD_SL_MIDPT:
+				return "KD_SL_MIDPT";
+			case KD_SL_FAIR:
+				return "KD_SL_FAIR";
+			case KD_SUGGEST:
+				return "KD_SUGGEST";
+			default:
+				return "[Unknown AnnSplitRule]";
+		}
+	}
+
+	static inline std::string ToString(AnnShrinkRule v) {
+		switch (v) {
+			case BD_NONE:
+				return "BD_NONE";
+			case BD_SIMPLE:
+				return "BD_SIMPLE";
+			case BD_CENTROID:
+				return "BD_CENTROID";
+			case BD_SUGGEST:
+				return "BD_SUGGEST";
+			default:
+				return "[Unknown AnnShrinkRule]";
+		}
+	}
+
+	// Returns false if v names no value of E, which runs from 0 to last
+	template<typename E>
+	static inline bool EnumFromString(const std::string &v, E last, E &value) {
+		for (int i = 0; i <= last; i++) {
+			if (ToString((E) i) == v) {
+				value = (E) i;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
 	static inline FeatureMatchingMethod FromString(const std::string &v) {
 		if (v == "STD") {
 			return FeatureMatchingMethod::STD;
@@ -34,6 +158,18 @@ public:
 			return FeatureMatchingMethod::KNN;
 		} else if (v == "RNN") {
 			return FeatureMatchingMethod::RNN;
+		} else if (v == "HNSW") {
+			return FeatureMatchingMethod::HNSW;
+		} else if (v == "SQ8") {
+			return FeatureMatchingMethod::SQ8;
+		} else if (v == "PQ") {
+			return FeatureMatchingMethod::PQ;
+		} else if (v == "GLOBAL") {
+			return FeatureMatchingMethod::GLOBAL;
+		} else if (v == "RANGE") {
+			return FeatureMatchingMethod::RANGE;
+		} else if (v == "IVF") {
+			return FeatureMatchingMethod::IVF;
 		}
 
 		// TODO throw error?
@@ -57,16 +193,46 @@ public:
 
 	static double standard_deviation(const std::vector<double>& numbers);
 
+	static void add_to_running_statistics(RunningStatistics &statistics, double number);
+
+	static void remove_from_running_statistics(RunningStatistics &statistics, double number);
+
+	static double running_standard_deviation(const RunningStatistics &statistics);
+
+	// Statistics of the union of both sets of numbers (Chan et al.)
+	static RunningStatistics merge_running_statistics(const RunningStatistics &a, const RunningStatistics &b);
+
+	// 64-bit FNV-1a; pass a previous result as seed to hash several buffers in sequence
+	static uint64_t hash(const void *data, size_t size, uint64_t seed = 14695981039346656037ULL);
+
 	static std::string serialize(const std::vector<double> &vec);
 
 	static std::vector<double> deserialize(const std::string &str);
 
+	static std::vector<double> sorted(std::vector<double> numbers);
+
 	static std::string filename_of_abs_path(const boost::filesystem::path &abs_path);
 
 	static char separator();
 
 	static std::vector<int> random_numbers(int amount_of_numbers, int maximum_range);
 
+	// Moves every coordinate of every centroid to the median of that coordinate over the samples assigned to it, which
+	// is the centre under the L1 distance. Samples are rows of sample_stride values, of which the dimension values from
+	// first_coordinate on are clustered; centroids are rows of dimension values. A centroid no sample is assigned to
+	// keeps its place.
+	static void move_centroids_to_medians(const std::vector<double> &samples, int sample_stride, int first_coordinate,
+	                                      int dimension, const std::vector<int> &assignments, int centroid_count,
+	                                      double *centroids);
+
+	// Calls function(begin, end) for consecutive ranges covering 0 to count, one range per core
+	static void parallel_for(int count, const std::function<void(int, int)> &function);
+
+	// Writes a file under a name of its own next to path and renames it over path, so readers never see a half-written
+	// file and processes writing the same file at once do not write into each other's; the last rename wins
+	static bool write_file_atomically(const boost::filesystem::path &path,
+	                                  const std::function<void(std::ostream &)> &write);
+
 	static std::vector<boost::filesystem::path>
 	files_to_vector(const boost::filesystem::path &if_abs_path, const std::string &extension);
 };
@@ -333,18 +333,21 @@ const ANNbool	ANN_ALLOW_SELF_MATCH	= ANNtrue;
 //----------------------------------------------------------------------
 //	Use the following for the Euclidean norm
 //----------------------------------------------------------------------
-#define ANN_POW(v)			((v)*(v))
-#define ANN_ROOT(x)			sqrt(x)
-#define ANN_SUM(x,y)		((x) + (y))
-#define ANN_DIFF(x,y)		((y) - (x))
+// #define ANN_POW(v)		((v)*(v))
+// #define ANN_ROOT(x)		sqrt(x)
+// #define ANN_SUM(x,y)		((x) + (y))
+// #define ANN_DIFF(x,y)	((y) - (x))
 
 //----------------------------------------------------------------------
 //	Use the following for the L_1 (Manhattan) norm
+//
+//	The backend uses this norm: with weighted coordinates and sorted
+//	histograms, the L_1 distance is the squared STD matching distance.
 //----------------------------------------------------------------------
-// #define ANN_POW(v)		fabs(v)
-// #define ANN_ROOT(x)		(x)
-// #define ANN_SUM(x,y)		((x) + (y))
-// #define ANN_DIFF(x,y)	((y) - (x))
+#define ANN_POW(v)			fabs(v)
+#define ANN_ROOT(x)			(x)
+#define ANN_SUM(x,y)		((x) + (y))
+#define ANN_DIFF(x,y)		((y) - (x))
 
 //----------------------------------------------------------------------
 //	Use the following for a general L_p norm
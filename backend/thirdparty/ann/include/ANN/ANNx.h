@@ -53,10 +53,13 @@ enum ANNerr {ANNwarn = 0, ANNabort = 1};
 //	number of points visited exceeds some threshold.  If the
 //	threshold is 0 (its default)  this means there is no limit
 //	and the algorithm applies its normal termination condition.
+//
+//	The backend makes these, like the other globals a search keeps its
+//	state in, thread_local, so several threads can search at once.
 //----------------------------------------------------------------------
 
-extern int		ANNmaxPtsVisited;	// maximum number of pts visited
-extern int		ANNptsVisited;		// number of pts visited in search
+extern thread_local int		ANNmaxPtsVisited;	// maximum number of pts visited
+extern thread_local int		ANNptsVisited;		// number of pts visited in search
 
 //----------------------------------------------------------------------
 //	Global function declarations